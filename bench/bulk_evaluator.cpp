@@ -0,0 +1,89 @@
+#include "evaluator.hpp"
+#include "scaling.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using namespace tynskills;
+
+/**
+ * Bulk allocation evaluation throughput from 1 to all cores.
+ *
+ * usage: bench_bulk_evaluator [profiles] [leafs]
+ */
+int main(int argc, char **argv) {
+  const int profiles = argc > 1 ? atoi(argv[1]) : 100000;
+  const int count = argc > 2 ? atoi(argv[2]) : 200;
+
+  // random tree growing from root, some leafs with two inputs
+  const BranchProgressMode modes[] = {BranchProgressMode::ANY,
+                                      BranchProgressMode::MINIMUM,
+                                      BranchProgressMode::MAXIMUM};
+  Skilltree skilltree;
+  std::mt19937 rng(1);
+  skilltree.begin_batch();
+  for (int i = 0; i < count; i++) {
+    const nodeid id = skilltree.add_leaf();
+    Skillinfo info;
+    info.points = 0;
+    info.maxpoints = 1 + (int)(rng() % 5);
+    info.active = false;
+    info.mode = i == 0 ? BranchProgressMode::MAXIMUM : modes[rng() % 3];
+    skilltree.get_leaf(id)->setup(info);
+    if (i == 0) {
+      continue;
+    }
+
+    skilltree.add_branch(rng() % i, i, modes[rng() % 3]);
+    if (i > 1 && rng() % 4 == 0) {
+      skilltree.add_branch(rng() % i, i, modes[rng() % 3]);
+    }
+  }
+  skilltree.commit();
+  const auto definition = skilltree.get_definition();
+
+  // leaf ids are topologically sorted here, so allocations grown in id
+  // order are legal. Every tenth one gets a point in random leaf
+  std::vector<int> points((size_t)profiles * count);
+  SkilltreeState state = definition->make_state();
+  for (int p = 0; p < profiles; p++) {
+    for (nodeid id = 0; id < count; id++) {
+      const bool active = definition->resolve_active(state, id);
+      state.active[id] = active;
+      state.points[id] =
+          active ? rng() % (definition->maxpoints[id] + 2) : 0;
+      state.points[id] = std::min(state.points[id], definition->maxpoints[id]);
+    }
+    if (p % 10 == 0) {
+      const nodeid id = rng() % count;
+      state.points[id] = std::min(state.points[id] + 1,
+                                  definition->maxpoints[id]);
+    }
+    std::copy(state.points.begin(), state.points.end(),
+              points.begin() + (size_t)p * count);
+  }
+
+  printf("leafs %d, profiles %d\n", count, profiles);
+  printf("%8s %12s %10s %16s %10s\n", "threads", "time ms", "speedup",
+         "profiles/s", "valid");
+
+  BulkEvaluator evaluator(definition);
+  BulkResult result;
+  scale_threads(
+      [&](int threads) {
+        evaluator.set_threads(threads);
+        evaluator.evaluate(points.data(), profiles, result);
+      },
+      [&](int threads, double ms, double speedup) {
+        int valid = 0;
+        for (int p = 0; p < result.count(); p++) {
+          valid += result.valid[p];
+        }
+
+        printf("%8d %12.1f %10.2f %16.0f %10d\n", threads, ms, speedup,
+               profiles / (ms / 1000.0), valid);
+      });
+
+  return 0;
+}
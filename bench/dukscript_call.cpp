@@ -0,0 +1,88 @@
+#include "dukscript.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+/**
+ * Per-call overhead of script function call paths: lookup by name with
+ * std::function arguments, resolved handle with std::function arguments and
+ * typed variadic call.
+ *
+ * usage: bench_dukscript_call [calls]
+ */
+int main(int argc, char **argv) {
+  const int calls = argc > 1 ? atoi(argv[1]) : 1000000;
+
+  SetTraceLogLevel(LOG_WARNING);
+  Dukscript dukscript;
+  // some globals, so name lookup isn't trivial
+  for (int i = 0; i < 256; i++) {
+    dukscript.eval(TextFormat("var global_%d = %d;", i, i));
+  }
+  dukscript.eval("function sum2(a, b) { return a + b; }"
+                 "function describe(a, b) { return 'leaf ' + a + '/' + b; }");
+  const int sum2 = dukscript.resolve("sum2");
+  const int describe = dukscript.resolve("describe");
+
+  // results summed, so calls can't be dropped
+  double check = 0;
+  auto measure = [&](const char *name, auto &&body) {
+    check = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < calls; i++) {
+      body(i);
+    }
+    const double ns = std::chrono::duration<double, std::nano>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+    printf("%-34s %10.1f ns/call %14.0f\n", name, ns / calls, check);
+  };
+
+  printf("calls %d\n", calls);
+  printf("%-34s %17s %14s\n", "path", "time", "check");
+  measure("int: name, std::function", [&](int i) {
+    const bool called = dukscript.call("sum2", [&]() {
+      dukscript.push_int(i);
+      dukscript.push_int(1);
+      return 2;
+    });
+    if (called) {
+      check += dukscript.get_float();
+      dukscript.pop(2);
+    }
+  });
+  measure("int: handle, std::function", [&](int i) {
+    const bool called = dukscript.call(sum2, [&]() {
+      dukscript.push_int(i);
+      dukscript.push_int(1);
+      return 2;
+    });
+    if (called) {
+      check += dukscript.get_float();
+      dukscript.pop(2);
+    }
+  });
+  measure("int: handle, call<int>", [&](int i) {
+    check += dukscript.call<int>(sum2, i, 1).value_or(0);
+  });
+
+  measure("string: name, std::function", [&](int i) {
+    const bool called = dukscript.call("describe", [&]() {
+      dukscript.push_int(i & 7);
+      dukscript.push_int(8);
+      return 2;
+    });
+    if (called) {
+      check += std::string(dukscript.get_string()).size();
+      dukscript.pop(2);
+    }
+  });
+  measure("string: handle, call<std::string>", [&](int i) {
+    check += dukscript.call<std::string>(describe, i & 7, 8)
+                 .value_or(std::string())
+                 .size();
+  });
+
+  return 0;
+}
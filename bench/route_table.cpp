@@ -0,0 +1,54 @@
+#include "graph.hpp"
+#include "scaling.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+using namespace tyngraph;
+
+/**
+ * Route table build scaling from 1 to all cores. Speedup column is
+ * meaningful only on machine with several hardware threads.
+ *
+ * usage: bench_route_table [nodes] [extra edges per node]
+ */
+int main(int argc, char **argv) {
+  const int count = argc > 1 ? atoi(argv[1]) : 100000;
+  const int extra = argc > 2 ? atoi(argv[2]) : 0;
+  const int cores = count_cores();
+
+  // random tree growing from root with a few extra forward edges
+  Graph graph;
+  graph.set_route_mode(RouteMode::TABLE);
+  std::mt19937 rng(1);
+  graph.begin_batch();
+  for (int i = 0; i < count; i++) {
+    graph.add_node();
+    if (i == 0) {
+      continue;
+    }
+
+    graph.add_edge(rng() % i, i, 1 + rng() % 4);
+    for (int e = 0; e < extra; e++) {
+      graph.add_edge(rng() % i, i, 1 + rng() % 4);
+    }
+  }
+  graph.commit();
+
+  printf("nodes %d, edges %d, hardware threads %d\n", graph.count_nodes(),
+         graph.count_edges(), cores);
+  if (cores == 1) {
+    printf("single hardware thread: table built by one worker, "
+           "no speedup measured\n");
+  }
+  printf("%8s %12s %10s %14s\n", "threads", "time ms", "speedup", "routes");
+
+  scale_threads(
+      [&](int threads) { graph.build_route_table(threads); },
+      [&](int threads, double ms, double speedup) {
+        printf("%8d %12.1f %10.2f %14zu\n", threads, ms, speedup,
+               graph.get_route_table()->count());
+      });
+
+  return 0;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+/**
+ * @returns {int} hardware threads, at least 1
+ */
+inline int count_cores() {
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/**
+ * @brief times run(threads) for 1, 2, 4 ... and all cores threads
+ *
+ * @param run runs measured work with given threads count
+ * @param report called after every run with threads count, time in ms
+ * and speedup over one thread
+ */
+template <typename Run, typename Report>
+void scale_threads(const Run &run, const Report &report) {
+  const int cores = count_cores();
+  double single = 0;
+  for (int threads = 1;; threads = std::min(threads * 2, cores)) {
+    const auto start = std::chrono::steady_clock::now();
+    run(threads);
+    const auto end = std::chrono::steady_clock::now();
+
+    const double ms =
+        std::chrono::duration<double, std::milli>(end - start).count();
+    if (threads == 1) {
+      single = ms;
+    }
+    report(threads, ms, single / ms);
+
+    if (threads == cores) {
+      break;
+    }
+  }
+}
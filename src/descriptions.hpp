@@ -0,0 +1,67 @@
+#pragma once
+#include "dukscript.hpp"
+#include <climits>
+#include <map>
+#include <string>
+#include <tuple>
+
+/**
+ * Leaf descriptions returned by script functions, memoized by function
+ * handle and leaf points. Script functions expected to be pure: same
+ * arguments give same text. Owned by Dukscript instance it reads, so
+ * reloading scripts drops cache with it.
+ *
+ * If call fails (script error, timeout or disabled function) description
+ * of same function for other points used instead, when there is one.
+ * Failed calls aren't cached, so they are retried on next get()
+ */
+class DescriptionCache {
+  Dukscript *dukscript;
+  // only texts returned by successful calls
+  std::map<std::tuple<int, int, int>, std::string> descriptions;
+  int hits = 0;
+  int misses = 0;
+
+  const char *fallback(int function) const {
+    auto it = this->descriptions.lower_bound(
+        std::make_tuple(function, INT_MIN, INT_MIN));
+    if (it != this->descriptions.end() && std::get<0>(it->first) == function) {
+      return it->second.c_str();
+    }
+
+    return NULL;
+  }
+
+public:
+  DescriptionCache(Dukscript *dukscript) { this->dukscript = dukscript; }
+
+  /**
+   * @param function handle from Dukscript::resolve()
+   * @param points
+   * @param maxpoints
+   * @returns description valid until clear() or NULL if function failed
+   * and there is no fallback
+   */
+  const char *get(int function, int points, int maxpoints) {
+    const auto key = std::make_tuple(function, points, maxpoints);
+    auto it = this->descriptions.find(key);
+    if (it != this->descriptions.end()) {
+      this->hits += 1;
+      return it->second.c_str();
+    }
+    this->misses += 1;
+
+    auto text = this->dukscript->call<std::string>(function, points, maxpoints);
+    if (!text) {
+      return this->fallback(function);
+    }
+
+    it = this->descriptions.emplace(key, std::move(*text)).first;
+    return it->second.c_str();
+  }
+
+  void clear() { this->descriptions.clear(); }
+
+  int get_hits() const { return this->hits; }
+  int get_misses() const { return this->misses; }
+};
@@ -0,0 +1,12 @@
+#include "dukscript.hpp"
+
+/**
+ * Polled by duktape executor, see DUK_USE_EXEC_TIMEOUT_CHECK in duk_config.h
+ *
+ * @param udata heap udata, Dukscript owning heap
+ */
+duk_bool_t dukscript_exec_timeout_check(void *udata) {
+	const Dukscript *dukscript = (const Dukscript *)udata;
+
+	return dukscript != NULL && dukscript->is_expired();
+}
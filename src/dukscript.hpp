@@ -1,6 +1,15 @@
+#pragma once
 #include "external/duktape.h"
 #include "raylib.h"
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
 
 static duk_ret_t native_print(duk_context *ctx) {
 	duk_push_string(ctx, " ");
@@ -24,6 +33,37 @@ static duk_ret_t call_json_decode(duk_context *ctx, void *t) {
 	return 1;
 }
 
+/**
+ * Wrapper for bytecode load safe call, duk_load_function throws on
+ * malformed buffer
+ */
+static duk_ret_t call_load_function(duk_context *ctx, void *) {
+	duk_load_function(ctx);
+
+	return 1;
+}
+
+/**
+ * Bytecode cache file header, dump data follows it
+ */
+struct BytecodeHeader {
+	char magic[4];
+	// dump format changes between duktape versions
+	uint32_t version;
+	uint64_t source_hash;
+	uint64_t source_length;
+};
+
+static uint64_t hash_source(const char *source, size_t length) {
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < length; i++) {
+		hash = (hash ^ (unsigned char)source[i]) * 1099511628211ull;
+	}
+
+	return hash;
+}
+
 static duk_ret_t native_sum(duk_context *ctx) {
 	int i;
 	int n = duk_get_top(ctx);  /* #args */
@@ -40,6 +80,117 @@ static duk_ret_t native_sum(duk_context *ctx) {
 class Dukscript {
 	duk_context *ctx;
 
+	/**
+	 * Restores value stack top on scope exit
+	 */
+	struct StackGuard {
+		duk_context *ctx;
+		duk_idx_t top;
+
+		StackGuard(duk_context *ctx) {
+			this->ctx = ctx;
+			this->top = duk_get_top(ctx);
+		}
+		~StackGuard() { duk_set_top(this->ctx, this->top); }
+	};
+
+	void push_value(int v) { duk_push_int(this->ctx, v); }
+	void push_value(double v) { duk_push_number(this->ctx, v); }
+	void push_value(bool v) { duk_push_boolean(this->ctx, v); }
+	void push_value(const char *v) { duk_push_string(this->ctx, v); }
+	void push_value(std::string_view v) {
+		duk_push_lstring(this->ctx, v.data(), v.size());
+	}
+
+	/**
+	 * @returns {bool} false if value has other type
+	 */
+	bool read_value(int &v, int idx) {
+		if (!duk_is_number(this->ctx, idx)) {
+			return false;
+		}
+		v = duk_get_int(this->ctx, idx);
+		return true;
+	}
+	bool read_value(double &v, int idx) {
+		if (!duk_is_number(this->ctx, idx)) {
+			return false;
+		}
+		v = duk_get_number(this->ctx, idx);
+		return true;
+	}
+	bool read_value(bool &v, int idx) {
+		if (!duk_is_boolean(this->ctx, idx)) {
+			return false;
+		}
+		v = duk_get_boolean(this->ctx, idx);
+		return true;
+	}
+	bool read_value(std::string &v, int idx) {
+		if (!duk_is_string(this->ctx, idx)) {
+			return false;
+		}
+		duk_size_t length = 0;
+		const char *str = duk_get_lstring(this->ctx, idx, &length);
+		v.assign(str, length);
+		return true;
+	}
+	// resolved function handles by name, -1 if function not found
+	std::map<std::string, int> functions;
+	// heap pointers of resolved functions, handle is index. Functions kept
+	// in heap stash, so they stay reachable and pointers valid
+	std::vector<void *> pointers;
+	// names of resolved functions and ones disabled after timeout
+	std::vector<std::string> names;
+	std::vector<uint8_t> disabled;
+
+	// per-call time budget in seconds, 0 for no limit
+	double budget = 0;
+	// deadline of running call, duktape polls it through
+	// dukscript_exec_timeout_check()
+	std::chrono::steady_clock::time_point deadline;
+	bool armed = false;
+	int timeouts = 0;
+
+	/**
+	 * Arms call deadline for scope if budget set
+	 */
+	struct Watchdog {
+		Dukscript *dukscript;
+
+		Watchdog(Dukscript *dukscript) {
+			this->dukscript = dukscript;
+			if (dukscript->budget > 0) {
+				dukscript->deadline =
+				    std::chrono::steady_clock::now() +
+				    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+				        std::chrono::duration<double>(dukscript->budget));
+				dukscript->armed = true;
+			}
+		}
+		~Watchdog() { this->dukscript->armed = false; }
+	};
+
+	/**
+	 * Logs error of failed call, it is on stack top. Function which ran out
+	 * of budget is disabled, so it doesn't stall every next frame
+	 *
+	 * @param handle function handle or -1 if called by name
+	 * @param funcname
+	 */
+	void report(int handle, const char *funcname) {
+		if (!this->is_expired()) {
+			TraceLog(LOG_ERROR, TextFormat("Call function Error: %s\n", duk_safe_to_string(ctx, -1)));
+			return;
+		}
+
+		this->timeouts += 1;
+		if (handle >= 0) {
+			this->disabled[handle] = true;
+		}
+		TraceLog(LOG_ERROR, TextFormat("Call function Error: '%s' exceeded %.1f ms budget%s", funcname, this->budget * 1000, handle >= 0 ? ", disabled" : ""));
+	}
+
 	void init(duk_context *ctx) {
 		duk_push_c_function(ctx, native_print, DUK_VARARGS);
 		duk_put_global_string(ctx, "print");
@@ -50,14 +201,39 @@ class Dukscript {
 	public:
 
 	Dukscript() {
-		this->ctx = duk_create_heap_default();
+		// heap udata is passed to exec timeout check
+		this->ctx = duk_create_heap(NULL, NULL, NULL, this, NULL);
 		this->init(this->ctx);
 	}
+	Dukscript(const Dukscript &) = delete;
+	Dukscript &operator=(const Dukscript &) = delete;
 	
 	~Dukscript() {
 		duk_destroy_heap(this->ctx);
 	}
 
+	/**
+	 * Limits run time of every function call. Script running longer is
+	 * aborted with RangeError, budget is checked every few hundred thousand
+	 * bytecode instructions. Evals aren't limited
+	 *
+	 * @param ms budget in milliseconds, 0 for no limit
+	 */
+	void set_call_budget(double ms) { this->budget = ms / 1000; }
+
+	/**
+	 * @returns {bool} true if running call is over its budget
+	 */
+	bool is_expired() const {
+		return this->armed && std::chrono::steady_clock::now() >= this->deadline;
+	}
+
+	bool is_disabled(int handle) const {
+		return handle >= 0 && this->disabled[handle];
+	}
+
+	int get_timeouts() const { return this->timeouts; }
+
 	void eval(const char *script) {
 		duk_eval_string_noresult(this->ctx, script);
 	}
@@ -78,6 +254,79 @@ class Dukscript {
 		return true;
 	}
 
+	/**
+	 * Evals file through compiled bytecode cache stored next to it
+	 * (filename + "c"). Cache used only if dumped from same source by same
+	 * duktape version, otherwise source compiled and cache written again.
+	 * Duktape doesn't validate bytecode, so cache file has to be trusted
+	 * as much as source
+	 *
+	 * @param filename path to script
+	 * @returns {bool} true if script evaluated
+	 */
+	bool eval_file_cached(const char *filename) {
+		char *source = LoadFileText(filename);
+		if (source == NULL) {
+			return false;
+		}
+
+		const size_t length = strlen(source);
+		const BytecodeHeader header = {{'D', 'K', 'B', 'C'},
+		                               (uint32_t)DUK_VERSION,
+		                               hash_source(source, length),
+		                               length};
+		const std::string cachename = std::string(filename) + "c";
+
+		bool loaded = false;
+		if (FileExists(cachename.c_str())) {
+			int size = 0;
+			unsigned char *data = LoadFileData(cachename.c_str(), &size);
+			if (data != NULL && size > (int)sizeof(header) &&
+			    memcmp(data, &header, sizeof(header)) == 0) {
+				const size_t dump_size = size - sizeof(header);
+				void *buffer = duk_push_fixed_buffer(this->ctx, dump_size);
+				memcpy(buffer, data + sizeof(header), dump_size);
+				loaded = duk_safe_call(this->ctx, call_load_function, NULL, 1, 1) ==
+				         DUK_EXEC_SUCCESS;
+				if (!loaded) {
+					this->pop(); // pop error
+				}
+			}
+			UnloadFileData(data);
+		}
+
+		if (!loaded) {
+			duk_push_string(this->ctx, filename);
+			if (duk_pcompile_lstring_filename(this->ctx, 0, source, length) != 0) {
+				TraceLog(LOG_ERROR, TextFormat("Eval file Error: %s\n", duk_safe_to_string(ctx, -1)));
+				this->pop();
+				UnloadFileText(source);
+				return false;
+			}
+
+			duk_dup(this->ctx, -1);
+			duk_dump_function(this->ctx);
+			duk_size_t dump_size = 0;
+			const void *dump = duk_get_buffer_data(this->ctx, -1, &dump_size);
+			std::vector<unsigned char> data(sizeof(header) + dump_size);
+			memcpy(data.data(), &header, sizeof(header));
+			memcpy(data.data() + sizeof(header), dump, dump_size);
+			// failed write only costs compile on next load
+			SaveFileData(cachename.c_str(), data.data(), data.size());
+			this->pop(); // pop dump
+		}
+		UnloadFileText(source);
+
+		if (duk_pcall(this->ctx, 0) != DUK_EXEC_SUCCESS) {
+			TraceLog(LOG_ERROR, TextFormat("Eval file Error: %s\n", duk_safe_to_string(ctx, -1)));
+			this->pop();
+			return false;
+		}
+		this->pop(); // pop result
+
+		return true;
+	}
+
 	/**
 	 * Call pop(2) on success
 	 *
@@ -98,8 +347,9 @@ class Dukscript {
 
 		int arguments = prep();
 
+		const Watchdog watchdog(this);
 		if(duk_pcall(this->ctx, arguments) != DUK_EXEC_SUCCESS) {
-				TraceLog(LOG_ERROR, TextFormat("Call function Error: %s\n", duk_safe_to_string(ctx, -1)));
+				this->report(-1, funcname);
 				this->pop(2);
 				return false;
 		}
@@ -107,6 +357,103 @@ class Dukscript {
 		return true;
 	}
 
+	/**
+	 * Stores global function in heap stash, so calls by handle push it
+	 * by pointer without property lookups. Missing function reported once,
+	 * same name resolved once
+	 *
+	 * @param funcname global function name
+	 * @returns {int} function handle or -1 if there is no such function
+	 */
+	int resolve(const char *funcname) {
+		const auto it = this->functions.find(funcname);
+		if (it != this->functions.end()) {
+			return it->second;
+		}
+
+		int handle = -1;
+		duk_push_global_object(this->ctx);
+		duk_get_prop_string(this->ctx, -1, funcname);
+		if (duk_is_function(this->ctx, -1)) {
+			handle = this->pointers.size();
+			this->pointers.push_back(duk_get_heapptr(this->ctx, -1));
+			this->names.push_back(funcname);
+			this->disabled.push_back(false);
+			duk_push_heap_stash(this->ctx);
+			duk_dup(this->ctx, -2);
+			duk_put_prop_index(this->ctx, -2, handle);
+			this->pop(); // pop stash
+		} else {
+			TraceLog(LOG_ERROR, TextFormat("Resolve function Error: no funciton '%s' found", funcname));
+		}
+		this->pop(2); // pop function, global
+
+		this->functions[funcname] = handle;
+		return handle;
+	}
+
+	/**
+	 * Calls function resolved by resolve(). Call pop(2) on success
+	 *
+	 * @param handle function handle, does nothing if -1 or disabled
+	 * @param prep arguments prepare
+	 *
+	 * @return 
+	 */
+	bool call(int handle, const std::function<int()> &prep) {
+		if (handle < 0 || this->disabled[handle]) {
+			return false;
+		}
+
+		// stash pushed in place of global object, stack shape same as
+		// call by name
+		duk_push_heap_stash(this->ctx);
+		duk_push_heapptr(this->ctx, this->pointers[handle]);
+
+		int arguments = prep();
+
+		const Watchdog watchdog(this);
+		if(duk_pcall(this->ctx, arguments) != DUK_EXEC_SUCCESS) {
+				this->report(handle, this->names[handle].c_str());
+				this->pop(2);
+				return false;
+		}
+
+		return true;
+	}
+
+	/**
+	 * Calls function resolved by resolve() with typed arguments, stack is
+	 * balanced on return. Arguments: int, double, bool, const char *,
+	 * std::string_view
+	 *
+	 * @param handle function handle, nothing called if -1 or disabled
+	 * @returns result or nullopt if call failed or result has other type.
+	 * Ret: int, double, bool or std::string
+	 */
+	template <typename Ret, typename... Args>
+	std::optional<Ret> call(int handle, const Args &...args) {
+		if (handle < 0 || this->disabled[handle]) {
+			return std::nullopt;
+		}
+
+		const StackGuard guard(this->ctx);
+		duk_push_heapptr(this->ctx, this->pointers[handle]);
+		(this->push_value(args), ...);
+
+		const Watchdog watchdog(this);
+		if (duk_pcall(this->ctx, sizeof...(Args)) != DUK_EXEC_SUCCESS) {
+			this->report(handle, this->names[handle].c_str());
+			return std::nullopt;
+		}
+
+		Ret result;
+		if (!this->read_value(result, -1)) {
+			return std::nullopt;
+		}
+
+		return result;
+	}
 
 	/**
 	 * evals json. Work with stack manually after that
@@ -152,6 +499,20 @@ class Dukscript {
 		return duk_get_string(this->ctx, idx);
 	}
 
+	float get_float(int idx = -1) {
+		return duk_is_number(this->ctx, idx) ? duk_to_number(this->ctx, idx) : 0;
+	}
+
+	/**
+	 * Enumerates object on top of stack: iterate with next(), pop(2)
+	 * after each key and pop() enumerator after all
+	 *
+	 * @param idx
+	 */
+	void enum_object(int idx = -1) {
+		duk_enum(this->ctx, idx, DUK_ENUM_OWN_PROPERTIES_ONLY);
+	}
+
 	/**
 	 * Do it when you need "enter" nested object
 	 * Don't forget to pop() after all operations made
@@ -0,0 +1,154 @@
+#include "evaluator.hpp"
+#include "workers.hpp"
+#include <algorithm>
+
+using namespace tynskills;
+
+BulkEvaluator::BulkEvaluator(
+    std::shared_ptr<const SkilltreeDefinition> definition) {
+  this->definition = definition;
+  this->threads = 0;
+
+  const Graph &graph = definition->graph;
+  for (nodeid id = 0; id < definition->count_leafs(); id++) {
+    if (graph.has_node(id)) {
+      this->order.push_back(id);
+    }
+  }
+  std::sort(this->order.begin(), this->order.end(),
+            [&graph](nodeid a, nodeid b) {
+              return graph.topological_position(a) <
+                     graph.topological_position(b);
+            });
+
+  this->input_offsets.push_back(0);
+  for (const nodeid id : this->order) {
+    for (const auto &eid : graph.inputs(id)) {
+      this->input_leafs.push_back(graph.edges[eid].nodea());
+      this->input_branches.push_back(definition->branches[eid]);
+    }
+    this->input_offsets.push_back(this->input_leafs.size());
+  }
+}
+
+/**
+ * @brief evaluates profiles [begin, end). Block arrays are leaf-major:
+ * leaf id * BLOCK + profile, so every leaf row is contiguous
+ */
+void BulkEvaluator::evaluate_block(const int *points, int begin, int end,
+                                   int budget, BulkResult &result,
+                                   std::vector<int> &block_points,
+                                   std::vector<uint8_t> &block_active) const {
+  const SkilltreeDefinition *definition = this->definition.get();
+  const int leafs = definition->count_leafs();
+  const int lanes = end - begin;
+  int total[BLOCK] = {};
+  uint8_t invalid[BLOCK] = {};
+  int active_branches[BLOCK];
+
+  // transpose into block rows, check points range
+  std::fill(block_active.begin(), block_active.end(), 0);
+  for (int p = 0; p < lanes; p++) {
+    const int *profile = points + (size_t)(begin + p) * leafs;
+    for (nodeid id = 0; id < leafs; id++) {
+      const int value = profile[id];
+      block_points[id * BLOCK + p] = value;
+      total[p] += value;
+      // removed leafs never active, so can't hold points
+      invalid[p] |= value < 0 || value > definition->maxpoints[id] ||
+                    (value > 0 && !definition->graph.has_node(id));
+    }
+  }
+
+  for (int i = 0; i < (int)this->order.size(); i++) {
+    const nodeid id = this->order[i];
+    const int first = this->input_offsets[i];
+    const int last = this->input_offsets[i + 1];
+
+    std::fill(active_branches, active_branches + lanes, 0);
+    for (int e = first; e < last; e++) {
+      const nodeid a = this->input_leafs[e];
+      const Branch &branch = this->input_branches[e];
+      const int maxpoints = definition->maxpoints[a];
+      const int *row_points = &block_points[a * BLOCK];
+      const uint8_t *row_active = &block_active[a * BLOCK];
+      for (int p = 0; p < lanes; p++) {
+        active_branches[p] +=
+            branch.is_active(row_active[p], row_points[p], maxpoints);
+      }
+    }
+
+    const BranchProgressMode mode = definition->modes[id];
+    const int total_branches = last - first;
+    int *row_points = &block_points[id * BLOCK];
+    uint8_t *row_active = &block_active[id * BLOCK];
+    for (int p = 0; p < lanes; p++) {
+      const bool active = SkilltreeDefinition::is_leaf_active(
+          mode, active_branches[p], total_branches);
+      invalid[p] |= row_points[p] > 0 && !active;
+      row_active[p] = active;
+      // refresh discards points of inactive leafs
+      row_points[p] = active ? row_points[p] : 0;
+    }
+  }
+
+  for (int p = 0; p < lanes; p++) {
+    const int profile = begin + p;
+    result.valid[profile] = !invalid[p] && (budget < 0 || total[p] <= budget);
+    result.points[profile] = total[p];
+
+    uint8_t *active = &result.active[(size_t)profile * leafs];
+    for (nodeid id = 0; id < leafs; id++) {
+      active[id] = block_active[id * BLOCK + p];
+    }
+  }
+}
+
+void BulkEvaluator::evaluate(const int *points, int profiles,
+                             BulkResult &result, int budget) const {
+  const int leafs = this->count_leafs();
+  result.leafs = leafs;
+  result.valid.assign(profiles, 0);
+  result.points.assign(profiles, 0);
+  result.active.assign((size_t)profiles * leafs, 0);
+
+  const int blocks = (profiles + BLOCK - 1) / BLOCK;
+  const int threads = resolve_threads(this->threads, blocks);
+
+  // workers take blocks one by one and write disjoint result ranges
+  WorkQueue queue(profiles, BLOCK);
+  run_workers(threads, [&](int) {
+    std::vector<int> block_points((size_t)leafs * BLOCK);
+    std::vector<uint8_t> block_active((size_t)leafs * BLOCK);
+
+    int begin, end;
+    while (queue.take(begin, end)) {
+      this->evaluate_block(points, begin, end, budget, result, block_points,
+                           block_active);
+    }
+  });
+}
+
+void BulkEvaluator::evaluate(const std::vector<std::vector<int>> &allocations,
+                             BulkResult &result, int budget) const {
+  const int leafs = this->count_leafs();
+  std::vector<int> points((size_t)allocations.size() * leafs, 0);
+  for (size_t p = 0; p < allocations.size(); p++) {
+    const auto &allocation = allocations[p];
+    const size_t count = std::min(allocation.size(), (size_t)leafs);
+    std::copy(allocation.begin(), allocation.begin() + count,
+              points.begin() + p * leafs);
+  }
+
+  this->evaluate(points.data(), allocations.size(), result, budget);
+
+  // points past last leaf given for leafs which don't exist, same as
+  // UNKNOWN_LEAF of SkilltreeDefinition::validate()
+  for (size_t p = 0; p < allocations.size(); p++) {
+    const auto &allocation = allocations[p];
+    for (size_t id = leafs; id < allocation.size(); id++) {
+      result.points[p] += allocation[id];
+      result.valid[p] &= allocation[id] == 0;
+    }
+  }
+}
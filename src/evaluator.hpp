@@ -0,0 +1,89 @@
+#pragma once
+#include "skilltree.hpp"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace tynskills {
+
+/**
+ * Bulk evaluation output. Arrays indexed by profile,
+ * active set indexed by profile * leafs + leaf id
+ */
+struct BulkResult {
+  int leafs = 0;
+  std::vector<uint8_t> valid;
+  std::vector<int> points;
+  std::vector<uint8_t> active;
+
+  int count() const { return this->valid.size(); }
+
+  bool is_active(int profile, nodeid id) const {
+    return this->active[(size_t)profile * this->leafs + id];
+  }
+};
+
+/**
+ * Evaluates many complete allocations (points of every leaf) against one
+ * definition. Profiles swept in blocks: each block walks leafs in
+ * topological order once, inner loops run across block profiles.
+ * Blocks spread across worker threads.
+ *
+ * Profile valid if every leaf points within [0, maxpoints], every leaf
+ * with points is active and total points fits budget. Active set is same
+ * refresh() would produce
+ */
+class BulkEvaluator {
+  std::shared_ptr<const SkilltreeDefinition> definition;
+  // live leafs in topological order
+  std::vector<nodeid> order;
+  // inputs of order[i] are input_offsets[i] .. input_offsets[i + 1]
+  std::vector<int> input_offsets;
+  std::vector<nodeid> input_leafs;
+  std::vector<Branch> input_branches;
+  int threads;
+
+  /**
+   * @brief evaluates profiles [begin, end), no more than BLOCK of them
+   */
+  void evaluate_block(const int *points, int begin, int end, int budget,
+                      BulkResult &result, std::vector<int> &block_points,
+                      std::vector<uint8_t> &block_active) const;
+
+public:
+  // profiles evaluated together by one sweep
+  static const int BLOCK = 64;
+
+  /**
+   * @param definition prepared definition, see Skilltree::get_definition()
+   */
+  BulkEvaluator(std::shared_ptr<const SkilltreeDefinition> definition);
+
+  /**
+   * @param threads worker threads count. 0 to use all cores
+   */
+  void set_threads(int threads) { this->threads = threads; }
+
+  int count_leafs() const { return this->definition->count_leafs(); }
+
+  /**
+   * @param points profile-major points: profile * count_leafs() + leaf id
+   * @param profiles
+   * @param result
+   * @param budget max points of profile. -1 for no limit
+   */
+  void evaluate(const int *points, int profiles, BulkResult &result,
+                int budget = -1) const;
+
+  /**
+   * @param allocations points vectors, count_leafs() entries each.
+   * Shorter vectors padded with zeros, profiles with points past last leaf
+   * invalid
+   * @param result
+   * @param budget max points of profile. -1 for no limit
+   */
+  void evaluate(const std::vector<std::vector<int>> &allocations,
+                BulkResult &result, int budget = -1) const;
+};
+
+} // namespace tynskills
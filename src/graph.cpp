@@ -1,6 +1,8 @@
 #include "graph.hpp"
+#include "workers.hpp"
+#include <algorithm>
+#include <functional>
 #include <map>
-#include <set>
 
 using namespace tyngraph;
 
@@ -8,8 +10,16 @@ using namespace tyngraph;
  * @returns new node id
  */
 nodeid Graph::add_node() {
-  const int guid = this->guids++;
-  this->nodes[guid] = Node();
+  const int guid = this->nodes.size();
+  this->nodes.push_back(Node());
+  this->out.add_node();
+  this->in.add_node();
+  this->topo_position.push_back(this->topo_order.size());
+  this->topo_order.push_back(guid);
+
+  if (this->reachability_valid) {
+    this->reachability.add_node();
+  }
 
   return guid;
 }
@@ -22,16 +32,39 @@ nodeid Graph::add_node() {
  * @param weight , or lenfth
  */
 edgeid Graph::add_edge(nodeid a, nodeid b, int weight) {
-  const int guid = this->guids++;
-	this->edges[guid] = Edge(a, b, weight);
+  const int guid = this->edges.size();
+	this->edges.push_back(Edge(a, b, weight));
+  this->out.add(a, guid);
+  this->in.add(b, guid);
+  // rebuilt once on commit() or build_route_table()
+  this->drop_route_table();
 
-  Node *nodea = &this->nodes[a];
-  Node *nodeb = &this->nodes[b];
-  nodea->add_edge(guid);
-  nodeb->add_edge(guid);
+  if (this->batching) {
+    // sorted once on commit or first query
+    this->topo_dirty = true;
+    this->reachability_valid = false;
+    return guid;
+  }
+
+  if (this->acyclic && !this->topo_dirty && !this->reorder(a, b)) {
+    this->acyclic = false;
+  }
+
+  if (this->reachability_valid) {
+    this->reachability.add_edge(a, b);
+  }
+
+  if (this->route_mode == RouteMode::LAZY) {
+    this->invalidate_added(this->edges[guid]);
+    return guid;
+  }
 
-  std::set<nodeid> traversed;
-  this->build(a, traversed);
+  if (this->route_mode == RouteMode::TABLE) {
+    return guid;
+  }
+
+  std::vector<nodeid> worklist = {a};
+  this->build(worklist);
 
 	return guid;
 }
@@ -48,7 +81,136 @@ void Graph::add_edge_bidir(nodeid a, nodeid b, int weight) {
   this->add_edge(b, a, weight);
 }
 
-int Graph::count_nodes() { return this->nodes.size(); }
+/**
+ * @brief removes edge. Rebuilds only routes which could pass it
+ *
+ * @param id
+ * @returns false if there is no such edge
+ */
+bool Graph::remove_edge(edgeid id) {
+  if (!this->has_edge(id)) {
+    return false;
+  }
+
+  const Edge edge = this->edges[id];
+  this->edges[id] = Edge();
+  this->out.remove(edge.nodea(), id);
+  this->in.remove(edge.nodeb(), id);
+  // closure can't be reduced, only rebuilt
+  this->reachability_valid = false;
+  this->drop_route_table();
+  this->topo_dirty = this->topo_dirty || !this->acyclic;
+
+  if (this->batching) {
+    return true;
+  }
+
+  if (this->route_mode == RouteMode::LAZY) {
+    this->invalidate_removed(edge);
+  } else if (this->route_mode == RouteMode::EAGER) {
+    this->rebuild_upstream({edge.nodea()});
+  }
+
+  return true;
+}
+
+/**
+ * @brief changes edge weight. Rebuilds only routes which could pass it
+ *
+ * @param id
+ * @param weight
+ * @returns false if there is no such edge
+ */
+bool Graph::set_weight(edgeid id, int weight) {
+  if (!this->has_edge(id)) {
+    return false;
+  }
+
+  const Edge edge = this->edges[id];
+  if (edge.weight() == weight) {
+    return true;
+  }
+
+  // adjacency keeps edge ids only, topology stays same
+  this->edges[id] = Edge(edge.nodea(), edge.nodeb(), weight);
+  this->drop_route_table();
+  if (this->batching) {
+    return true;
+  }
+
+  if (this->route_mode == RouteMode::LAZY) {
+    this->invalidate_removed(edge);
+    this->invalidate_added(this->edges[id]);
+  } else if (this->route_mode == RouteMode::EAGER) {
+    this->rebuild_upstream({edge.nodea()});
+  }
+
+  return true;
+}
+
+/**
+ * @brief removes node and all its edges. Removed ids are not reused
+ *
+ * @param id
+ * @returns false if there is no such node
+ */
+bool Graph::remove_node(nodeid id) {
+  if (!this->has_node(id)) {
+    return false;
+  }
+
+  // spans invalidated on first removal
+  std::vector<edgeid> incident;
+  for (const edgeid &eid : this->outputs(id)) {
+    incident.push_back(eid);
+  }
+  for (const edgeid &eid : this->inputs(id)) {
+    incident.push_back(eid);
+  }
+
+  std::vector<nodeid> starts = {id};
+  for (const edgeid &eid : incident) {
+    const Edge edge = this->edges[eid];
+    if (edge.nodea() < 0) {
+      // self loop listed twice
+      continue;
+    }
+
+    this->edges[eid] = Edge();
+    this->out.remove(edge.nodea(), eid);
+    this->in.remove(edge.nodeb(), eid);
+    starts.push_back(edge.nodea());
+    if (this->route_mode == RouteMode::LAZY && !this->batching) {
+      this->invalidate_removed(edge);
+    }
+  }
+
+  this->nodes[id].removed = true;
+  this->nodes[id].routes.clear();
+  this->reachability_valid = false;
+  this->topo_dirty = this->topo_dirty || !this->acyclic;
+
+  if (this->route_mode == RouteMode::LAZY) {
+    this->route_cache.invalidate(
+        [id](const SourceRoutes &routes) { return routes.source == id; });
+  } else if (this->route_mode == RouteMode::TABLE) {
+    this->drop_route_table();
+  } else if (!this->batching) {
+    this->rebuild_upstream(starts);
+  }
+
+  return true;
+}
+
+int Graph::count_nodes() const { return this->nodes.size(); }
+
+int Graph::count_edges() { return this->edges.size(); }
+
+/**
+ * @brief sorts nodes, so const queries could be used. Prepared graph
+ * can be read from several threads
+ */
+void Graph::prepare() { this->is_acyclic(); }
 
 /**
  * @brief returns next node required to reach b form a
@@ -58,6 +220,48 @@ int Graph::count_nodes() { return this->nodes.size(); }
  * @reurns next node in path or -1 if no path found
  */
 nodeid Graph::route(nodeid a, nodeid b) {
+  if (this->route_mode != RouteMode::LAZY) {
+    return static_cast<const Graph *>(this)->route(a, b);
+  }
+
+  if (a < 0 || a >= this->count_nodes()) {
+    return -1;
+  }
+
+  SourceRoutes *routes = this->route_cache.find(a);
+  if (routes == nullptr) {
+    routes = this->route_cache.insert(a);
+    this->search(a, routes);
+  }
+
+  // nodes added after search are not reachable yet
+  return routes->reaches(b) ? routes->next[b] : -1;
+}
+
+/**
+ * @brief const version of route(). Safe to call from several threads
+ * in EAGER and TABLE modes while graph isn't changed. LAZY mode searches
+ * every call without caching
+ */
+nodeid Graph::route(nodeid a, nodeid b) const {
+  if (a < 0 || a >= this->count_nodes()) {
+    return -1;
+  }
+
+  if (this->route_mode == RouteMode::TABLE) {
+    // swapped only by non const methods, plain read is enough
+    const RouteTable *table = this->route_table.get();
+
+    return table == nullptr ? -1 : table->route(a, b);
+  }
+
+  if (this->route_mode == RouteMode::LAZY) {
+    Pathfinder pathfinder;
+    pathfinder.search(*this, a);
+
+    return pathfinder.next_to(b);
+  }
+
   const Node *nodea = &this->nodes[a];
   const auto route = nodea->routes.find(b);
   if (route == nodea->routes.end()) {
@@ -67,48 +271,946 @@ nodeid Graph::route(nodeid a, nodeid b) {
   return route->second.next();
 }
 
-void Graph::build(nodeid a, std::set<nodeid> &traversed) {
+/**
+ * @brief rebuilds routes of node from its direct outputs routes
+ *
+ * @param a
+ * @returns true if any route of node changed
+ */
+bool Graph::build(nodeid a) {
+  std::map<nodeid, Route> routes;
+
+  for (const edgeid &id : this->outputs(a)) {
+    const Edge *edge = &this->edges[id];
+    const nodeid b = edge->nodeb();
+    const int weight = edge->weight();
+
+    // direct route
+    auto direct = routes.find(b);
+    if (direct == routes.end() || direct->second.length() > weight) {
+      routes.insert_or_assign(b, Route(a, b, b, weight));
+    }
+
+    // dependent routes
+    for (const auto &[end, route] : this->nodes[b].routes) {
+      const int length = route.length() + weight;
+      const auto existing = routes.find(end);
+      if (existing != routes.end() && existing->second.length() <= length) {
+        continue;
+      }
+
+      routes.insert_or_assign(end, Route(a, end, b, length));
+    }
+  }
+
   Node *nodea = &this->nodes[a];
+  bool changed = routes.size() != nodea->routes.size();
+  if (!changed) {
+    auto it = nodea->routes.begin();
+    for (const auto &[end, route] : routes) {
+      const Route &old = it->second;
+      if (it->first != end || old.next() != route.next() ||
+          old.length() != route.length()) {
+        changed = true;
+        break;
+      }
+      ++it;
+    }
+  }
+
+  if (changed) {
+    nodea->routes.swap(routes);
+  }
 
-  if (traversed.count(a) > 0) {
+  return changed;
+}
+
+/**
+ * @brief rebuilds routes of nodes in list and all nodes which routes
+ * depends on changed ones
+ *
+ * @param worklist nodes to rebuild. Consumed
+ */
+void Graph::build(std::vector<nodeid> &worklist) {
+  while (!worklist.empty()) {
+    const nodeid a = worklist.back();
+    worklist.pop_back();
+
+    if (!this->build(a)) {
+      continue;
+    }
+
+    for (const edgeid &id : this->inputs(a)) {
+      worklist.push_back(this->edges[id].nodea());
+    }
+  }
+}
+
+/**
+ * @brief starts batch mode. Edges added in batch mode only recorded,
+ * routes are not valid until commit() called
+ */
+void Graph::begin_batch() { this->batching = true; }
+
+/**
+ * @brief leaves batch mode and builds all routes in one pass
+ */
+void Graph::commit() {
+  this->batching = false;
+  // spans moved while batch grew them
+  this->out.compact();
+  this->in.compact();
+
+  if (this->route_mode == RouteMode::LAZY) {
+    this->route_cache.clear();
+    return;
+  }
+
+  if (this->route_mode == RouteMode::TABLE) {
+    this->build_route_table(this->route_threads);
+    return;
+  }
+
+  this->build();
+}
+
+/**
+ * @brief switches routes storage. EAGER mode builds all routes
+ * immediately, LAZY mode drops them and searches on demand,
+ * TABLE mode builds all routes in parallel immediately
+ *
+ * @param mode
+ * @param cache_capacity how many sources LAZY mode keeps
+ */
+void Graph::set_route_mode(RouteMode mode, int cache_capacity) {
+  this->route_cache.set_capacity(cache_capacity);
+  if (mode == this->route_mode) {
+    return;
+  }
+
+  this->route_mode = mode;
+  this->route_cache.clear();
+  this->drop_route_table();
+
+  if (mode != RouteMode::EAGER) {
+    for (Node &node : this->nodes) {
+      node.routes.clear();
+    }
+  }
+
+  if (this->batching) {
     return;
   }
+  if (mode == RouteMode::EAGER) {
+    this->build();
+  } else if (mode == RouteMode::TABLE) {
+    this->build_route_table(this->route_threads);
+  }
+}
+
+/**
+ * @brief rebuilds routes of all nodes
+ */
+void Graph::build() {
+  const int count = this->count_nodes();
+  for (Node &node : this->nodes) {
+    node.routes.clear();
+  }
+
+  // nodes processed leafs first: node built only after all its outputs
+  std::vector<int> pending(count);
+  std::vector<nodeid> ready;
+  for (nodeid id = 0; id < count; id++) {
+    pending[id] = this->outputs(id).size();
+    if (pending[id] == 0) {
+      ready.push_back(id);
+    }
+  }
+
+  int built = 0;
+  while (!ready.empty()) {
+    const nodeid a = ready.back();
+    ready.pop_back();
+
+    this->build(a);
+    built += 1;
+
+    for (const edgeid &id : this->inputs(a)) {
+      const nodeid prev = this->edges[id].nodea();
+      if (--pending[prev] == 0) {
+        ready.push_back(prev);
+      }
+    }
+  }
+
+  if (built == count) {
+    return;
+  }
+
+  // nodes on cycles and above them left. Rebuild until routes settle
+  std::vector<nodeid> worklist;
+  for (nodeid id = 0; id < count; id++) {
+    if (pending[id] > 0) {
+      worklist.push_back(id);
+    }
+  }
+  this->build(worklist);
+}
+
+/**
+ * @brief builds routes from every source using several threads
+ * and publishes them as read only table
+ *
+ * @param threads worker threads count. 0 to use all cores
+ */
+void Graph::build_route_table(int threads) {
+  const int count = this->count_nodes();
+  threads = resolve_threads(threads, count);
+
+  // each worker takes sources by small chunks and keeps own results
+  struct Chunk {
+    std::vector<nodeid> sources;
+    std::vector<int> counts;
+    std::vector<nodeid> ends;
+    std::vector<nodeid> next;
+    std::vector<int> length;
+  };
+  std::vector<Chunk> chunks(threads);
+  WorkQueue queue(count, 64);
+
+  run_workers(threads, [&](int index) {
+    Chunk *chunk = &chunks[index];
+    Pathfinder pathfinder;
+    std::vector<nodeid> reached;
 
-  traversed.insert(a);
+    int begin, end;
+    while (queue.take(begin, end)) {
+      for (nodeid a = begin; a < end; a++) {
+        chunk->sources.push_back(a);
+        if (this->nodes[a].removed) {
+          chunk->counts.push_back(0);
+          continue;
+        }
 
-  // iterate forward
-  for (const edgeid &id : nodea->edges) {
-    const Edge *edge = &this->edges.at(id);
-    if (edge->nodea() != a) {
+        pathfinder.search(*this, a);
+        reached = pathfinder.get_settled();
+        std::sort(reached.begin(), reached.end());
+
+        for (const nodeid &b : reached) {
+          chunk->ends.push_back(b);
+          chunk->next.push_back(pathfinder.next_to(b));
+          chunk->length.push_back(pathfinder.length_to(b));
+        }
+        chunk->counts.push_back(reached.size());
+      }
+    }
+  });
+
+  // merge chunks ordered by source
+  std::shared_ptr<RouteTable> table = std::make_shared<RouteTable>();
+  table->offsets.assign(count + 1, 0);
+  for (const Chunk &chunk : chunks) {
+    for (size_t i = 0; i < chunk.sources.size(); i++) {
+      table->offsets[chunk.sources[i] + 1] = chunk.counts[i];
+    }
+  }
+  for (int i = 0; i < count; i++) {
+    table->offsets[i + 1] += table->offsets[i];
+  }
+
+  const size_t total = table->offsets[count];
+  table->ends.resize(total);
+  table->next.resize(total);
+  table->length.resize(total);
+  for (const Chunk &chunk : chunks) {
+    size_t from = 0;
+    for (size_t i = 0; i < chunk.sources.size(); i++) {
+      const size_t to = table->offsets[chunk.sources[i]];
+      const size_t size = chunk.counts[i];
+      std::copy_n(chunk.ends.begin() + from, size, table->ends.begin() + to);
+      std::copy_n(chunk.next.begin() + from, size, table->next.begin() + to);
+      std::copy_n(chunk.length.begin() + from, size,
+                  table->length.begin() + to);
+      from += size;
+    }
+  }
+
+  this->route_table = std::move(table);
+}
+
+/**
+ * @returns route table or nullptr if it's not built since last change.
+ * Returned table stays valid after graph change and can be queried from
+ * any thread
+ */
+std::shared_ptr<const RouteTable> Graph::get_route_table() const {
+  return this->route_table;
+}
+
+void Graph::drop_route_table() { this->route_table.reset(); }
+
+/**
+ * @param a
+ * @param b
+ * @returns next node in path from a to b or -1 if no path found
+ */
+nodeid RouteTable::route(nodeid a, nodeid b) const {
+  const long entry = this->find(a, b);
+
+  return entry < 0 ? -1 : this->next[entry];
+}
+
+/**
+ * @param a
+ * @param b
+ * @returns path length from a to b or -1 if no path found
+ */
+int RouteTable::length_of(nodeid a, nodeid b) const {
+  const long entry = this->find(a, b);
+
+  return entry < 0 ? -1 : this->length[entry];
+}
+
+/**
+ * @returns entry index or -1
+ */
+long RouteTable::find(nodeid a, nodeid b) const {
+  if (a < 0 || a + 1 >= (int)this->offsets.size()) {
+    return -1;
+  }
+
+  const auto first = this->ends.begin() + this->offsets[a];
+  const auto last = this->ends.begin() + this->offsets[a + 1];
+  const auto it = std::lower_bound(first, last, b);
+  if (it == last || *it != b) {
+    return -1;
+  }
+
+  return it - this->ends.begin();
+}
+
+/**
+ * @brief drops cached routes which could get shorter with new edge
+ */
+void Graph::invalidate_added(const Edge &edge) {
+  const nodeid a = edge.nodea();
+  this->route_cache.invalidate([a](const SourceRoutes &routes) {
+    return routes.source == a || routes.reaches(a);
+  });
+}
+
+/**
+ * @brief drops cached routes which could pass removed edge
+ */
+void Graph::invalidate_removed(const Edge &edge) {
+  const nodeid a = edge.nodea();
+  const nodeid b = edge.nodeb();
+  const int weight = edge.weight();
+  this->route_cache.invalidate([a, b, weight](const SourceRoutes &routes) {
+    // edge used only if it lies on shortest path to b
+    if (!routes.reaches(b)) {
+      return false;
+    }
+    if (routes.source == a) {
+      return routes.length[b] == weight;
+    }
+
+    return routes.reaches(a) && routes.length[a] + weight == routes.length[b];
+  });
+}
+
+/**
+ * @brief clears and rebuilds routes of nodes and all their ancestors
+ *
+ * @param starts
+ */
+void Graph::rebuild_upstream(const std::vector<nodeid> &starts) {
+  this->reset_marks();
+  std::vector<nodeid> upstream;
+  for (const nodeid &id : starts) {
+    if (this->mark(id)) {
+      upstream.push_back(id);
+    }
+  }
+
+  for (size_t i = 0; i < upstream.size(); i++) {
+    for (const edgeid &id : this->inputs(upstream[i])) {
+      const nodeid prev = this->edges[id].nodea();
+      if (this->mark(prev)) {
+        upstream.push_back(prev);
+      }
+    }
+  }
+
+  // nodes not in upstream can't route through changed nodes.
+  // Worklist pops from back, so nearest to change built first
+  for (const nodeid &id : upstream) {
+    this->nodes[id].routes.clear();
+  }
+  std::reverse(upstream.begin(), upstream.end());
+  this->build(upstream);
+}
+
+/**
+ * @brief starts new traversal. All nodes become unmarked
+ */
+void Graph::reset_marks() {
+  if (this->marks.size() < this->nodes.size()) {
+    this->marks.resize(this->nodes.size(), 0);
+  }
+
+  this->mark_stamp += 1;
+  if (this->mark_stamp == 0) {
+    // stamp overflow. Old marks could match again
+    std::fill(this->marks.begin(), this->marks.end(), 0);
+    this->mark_stamp = 1;
+  }
+}
+
+/**
+ * @brief finds shortest routes from source to all nodes
+ *
+ * @param a source
+ * @param routes result
+ */
+void Graph::search(nodeid a, SourceRoutes *routes) {
+  const int count = this->count_nodes();
+  this->pathfinder.search(*this, a);
+
+  routes->source = a;
+  routes->next.resize(count);
+  routes->length.resize(count);
+  for (nodeid id = 0; id < count; id++) {
+    routes->next[id] = this->pathfinder.next_to(id);
+    routes->length[id] = this->pathfinder.length_to(id);
+  }
+}
+
+/**
+ * @brief O(1) check using transitive closure index.
+ * Index built on first call
+ *
+ * @param a
+ * @param b
+ * @returns true if there is path from a to b
+ */
+bool Graph::is_reachable(nodeid a, nodeid b) {
+  return this->get_reachability()->is_reachable(a, b);
+}
+
+/**
+ * @returns false if graph has cycles
+ */
+bool Graph::is_acyclic() {
+  if (this->topo_dirty) {
+    this->sort_topologically();
+  }
+
+  return this->acyclic;
+}
+
+/**
+ * @brief checks if edge from a to b would close a cycle
+ *
+ * @param a
+ * @param b
+ */
+bool Graph::creates_cycle(nodeid a, nodeid b) {
+  if (a == b) {
+    return true;
+  }
+
+  if (!this->is_acyclic()) {
+    return this->is_reachable(b, a);
+  }
+
+  if (this->topo_position[a] < this->topo_position[b]) {
+    return false;
+  }
+
+  // only nodes placed between b and a can lead back to a
+  const int ub = this->topo_position[a];
+  std::vector<nodeid> stack = {b};
+  this->reset_marks();
+  this->mark(b);
+  while (!stack.empty()) {
+    const nodeid id = stack.back();
+    stack.pop_back();
+
+    for (const edgeid &eid : this->outputs(id)) {
+      const nodeid next = this->edges[eid].nodeb();
+      if (next == a) {
+        return true;
+      }
+      if (this->topo_position[next] < ub && this->mark(next)) {
+        stack.push_back(next);
+      }
+    }
+  }
+
+  return false;
+}
+
+/**
+ * @brief removes edges which close cycles. Edges checked in id order,
+ * so same edges removed as if every one checked by creates_cycle() before
+ * adding. Whole graph sorted once, edges placed one by one only if it
+ * has cycles
+ *
+ * @param first edges with smaller ids are kept. Graph without them has
+ * to be acyclic
+ * @returns removed edges ids
+ */
+std::vector<edgeid> Graph::break_cycles(edgeid first) {
+  std::vector<edgeid> removed;
+  if (this->is_acyclic()) {
+    return removed;
+  }
+
+  std::vector<edgeid> added;
+  for (edgeid id = first; id < this->count_edges(); id++) {
+    if (this->has_edge(id)) {
+      const Edge &edge = this->edges[id];
+      this->out.remove(edge.nodea(), id);
+      this->in.remove(edge.nodeb(), id);
+      added.push_back(id);
+    }
+  }
+
+  this->sort_topologically();
+  if (!this->acyclic) {
+    // cycles not made by these edges, nothing to remove. add() puts
+    // edges back at their sorted positions
+    for (const edgeid &id : added) {
+      this->out.add(this->edges[id].nodea(), id);
+      this->in.add(this->edges[id].nodeb(), id);
+    }
+    this->topo_dirty = true;
+    return removed;
+  }
+
+  for (const edgeid &id : added) {
+    const Edge edge = this->edges[id];
+    if (!this->reorder(edge.nodea(), edge.nodeb())) {
+      this->edges[id] = Edge();
+      removed.push_back(id);
       continue;
     }
+    this->out.add(edge.nodea(), id);
+    this->in.add(edge.nodeb(), id);
+  }
+  this->reachability_valid = false;
 
-    // add new direct route
-    const nodeid b = edge->nodeb();
-    Node *nodeb = &this->nodes[b];
-    nodea->add_route(edge->nodea(), edge->nodeb(), edge->nodeb(),
-                     edge->weight());
-
-    // add dependent routes
-    for (const auto &[id, route] : nodeb->routes) {
-      // check if route already exists and new one shorter
-      const auto existing_route = nodea->routes.find(route.end());
-      if (existing_route != nodea->routes.end() &&
-          existing_route->second.length() - edge->weight() < route.length()) {
-        continue;
+  return removed;
+}
+
+/**
+ * @brief all nodes ordered so every edge goes forward.
+ * Valid only if is_acyclic()
+ */
+const std::vector<nodeid> &Graph::topological_order() {
+  this->is_acyclic();
+
+  return this->topo_order;
+}
+
+/**
+ * @returns node index in topological_order()
+ */
+int Graph::topological_position(nodeid id) {
+  this->is_acyclic();
+
+  return this->topo_position[id];
+}
+
+/**
+ * @brief moves nodes so edge from a to b goes forward in topological
+ * order. Only nodes between b and a positions visited
+ *
+ * @returns false if edge closes a cycle
+ */
+bool Graph::reorder(nodeid a, nodeid b) {
+  const int lb = this->topo_position[b];
+  const int ub = this->topo_position[a];
+  if (lb > ub) {
+    return true;
+  }
+  if (a == b) {
+    return false;
+  }
+
+  this->reset_marks();
+
+  // nodes reachable from b which has to be moved after a
+  std::vector<nodeid> forward = {b};
+  this->mark(b);
+  for (size_t i = 0; i < forward.size(); i++) {
+    for (const edgeid &eid : this->outputs(forward[i])) {
+      const nodeid next = this->edges[eid].nodeb();
+      if (next == a) {
+        return false;
+      }
+      if (this->topo_position[next] < ub && this->mark(next)) {
+        forward.push_back(next);
+      }
+    }
+  }
+
+  // nodes reaching a which has to be moved before b
+  std::vector<nodeid> backward = {a};
+  this->mark(a);
+  for (size_t i = 0; i < backward.size(); i++) {
+    for (const edgeid &eid : this->inputs(backward[i])) {
+      const nodeid prev = this->edges[eid].nodea();
+      if (this->topo_position[prev] > lb && this->mark(prev)) {
+        backward.push_back(prev);
+      }
+    }
+  }
+
+  const auto by_position = [this](nodeid l, nodeid r) {
+    return this->topo_position[l] < this->topo_position[r];
+  };
+  std::sort(forward.begin(), forward.end(), by_position);
+  std::sort(backward.begin(), backward.end(), by_position);
+
+  // same positions reused: backward nodes first, then forward ones
+  std::vector<int> positions;
+  for (const nodeid &id : backward) {
+    positions.push_back(this->topo_position[id]);
+  }
+  for (const nodeid &id : forward) {
+    positions.push_back(this->topo_position[id]);
+  }
+  std::sort(positions.begin(), positions.end());
+
+  size_t i = 0;
+  for (const nodeid &id : backward) {
+    this->topo_position[id] = positions[i];
+    this->topo_order[positions[i++]] = id;
+  }
+  for (const nodeid &id : forward) {
+    this->topo_position[id] = positions[i];
+    this->topo_order[positions[i++]] = id;
+  }
+
+  return true;
+}
+
+/**
+ * @brief sorts all nodes from scratch
+ */
+void Graph::sort_topologically() {
+  const int count = this->count_nodes();
+  std::vector<int> pending(count);
+  this->topo_order.clear();
+  for (nodeid id = 0; id < count; id++) {
+    pending[id] = this->inputs(id).size();
+    if (pending[id] == 0) {
+      this->topo_order.push_back(id);
+    }
+  }
+
+  for (size_t i = 0; i < this->topo_order.size(); i++) {
+    for (const edgeid &eid : this->outputs(this->topo_order[i])) {
+      const nodeid next = this->edges[eid].nodeb();
+      if (--pending[next] == 0) {
+        this->topo_order.push_back(next);
       }
+    }
+  }
 
-      nodea->add_route(a, route.end(), b, route.length() + edge->weight());
+  this->acyclic = (int)this->topo_order.size() == count;
+  this->topo_dirty = false;
+  if (!this->acyclic) {
+    // cycles left unordered. Kept in list to have all nodes positioned
+    for (nodeid id = 0; id < count; id++) {
+      if (pending[id] > 0) {
+        this->topo_order.push_back(id);
+      }
     }
   }
 
-  // iterade backward
-  for (const edgeid &id : nodea->edges) {
-    const Edge *edge = &this->edges.at(id);
-    if (edge->nodeb() != a) {
+  for (int i = 0; i < count; i++) {
+    this->topo_position[this->topo_order[i]] = i;
+  }
+}
+
+/**
+ * @returns transitive closure index. Built if outdated
+ */
+const Reachability *Graph::get_reachability() {
+  if (!this->reachability_valid) {
+    this->reachability.build(*this);
+    this->reachability_valid = true;
+  }
+
+  return &this->reachability;
+}
+
+/**
+ * @brief finds shortest path from a to b
+ *
+ * @param a
+ * @param b
+ * @param nodes result. Cleared and filled with path nodes from a to b.
+ * Reuse same vector to avoid allocations
+ * @returns total path length or -1 if no path found
+ */
+int Graph::path(nodeid a, nodeid b, std::vector<nodeid> &nodes) {
+  nodes.clear();
+  const int count = this->count_nodes();
+  if (a < 0 || a >= count || b < 0 || b >= count) {
+    return -1;
+  }
+
+  if (a == b) {
+    nodes.push_back(a);
+    return 0;
+  }
+
+  this->pathfinder.search(*this, a, b);
+
+  return this->pathfinder.path_to(b, nodes);
+}
+
+/**
+ * @brief finds shortest paths from a. Source itself counted reached
+ * only through a cycle
+ *
+ * @param graph
+ * @param a source
+ * @param b target to stop at, or -1 to search all nodes
+ */
+void Pathfinder::search(const Graph &graph, nodeid a, nodeid b) {
+  const int count = graph.count_nodes();
+  if ((int)this->reached.size() < count) {
+    this->length.resize(count);
+    this->prev.resize(count);
+    this->first.resize(count);
+    this->reached.resize(count, 0);
+    this->settled.resize(count, 0);
+  }
+
+  this->stamp += 1;
+  if (this->stamp == 0) {
+    // stamp overflow. Old marks could match again
+    std::fill(this->reached.begin(), this->reached.end(), 0);
+    std::fill(this->settled.begin(), this->settled.end(), 0);
+    this->stamp = 1;
+  }
+
+  this->source = a;
+  this->heap.clear();
+  this->order.clear();
+  const auto greater = [](const Step &l, const Step &r) {
+    return l.length > r.length;
+  };
+
+  const auto relax = [&](nodeid from, nodeid to, nodeid first, int length) {
+    if (this->settled[to] == this->stamp ||
+        (this->reached[to] == this->stamp && this->length[to] <= length)) {
+      return;
+    }
+
+    this->reached[to] = this->stamp;
+    this->length[to] = length;
+    this->prev[to] = from;
+    this->first[to] = first;
+    this->heap.push_back({length, to});
+    std::push_heap(this->heap.begin(), this->heap.end(), greater);
+  };
+
+  for (const edgeid &id : graph.outputs(a)) {
+    const Edge *edge = &graph.edges[id];
+    relax(a, edge->nodeb(), edge->nodeb(), edge->weight());
+  }
+
+  while (!this->heap.empty()) {
+    std::pop_heap(this->heap.begin(), this->heap.end(), greater);
+    const Step step = this->heap.back();
+    this->heap.pop_back();
+
+    const nodeid id = step.node;
+    if (this->settled[id] == this->stamp || step.length > this->length[id]) {
       continue;
     }
+    this->settled[id] = this->stamp;
+    this->order.push_back(id);
+
+    if (id == b) {
+      return;
+    }
 
-    this->build(edge->nodea(), traversed);
+    for (const edgeid &eid : graph.outputs(id)) {
+      const Edge *edge = &graph.edges[eid];
+      relax(id, edge->nodeb(), this->first[id], step.length + edge->weight());
+    }
   }
 }
+
+/**
+ * @brief writes path from source to node
+ *
+ * @param id
+ * @param nodes result. Cleared and filled with path nodes
+ * @returns path length or -1 if not reached
+ */
+int Pathfinder::path_to(nodeid id, std::vector<nodeid> &nodes) const {
+  nodes.clear();
+  if (!this->is_reached(id)) {
+    return -1;
+  }
+
+  nodes.push_back(id);
+  nodeid it = id;
+  do {
+    it = this->prev[it];
+    nodes.push_back(it);
+  } while (it != this->source);
+
+  std::reverse(nodes.begin(), nodes.end());
+
+  return this->length[id];
+}
+
+/**
+ * @param source
+ * @returns cached routes or nullptr. Marks entry as recently used
+ */
+SourceRoutes *RouteCache::find(nodeid source) {
+  const auto it = this->index.find(source);
+  if (it == this->index.end()) {
+    return nullptr;
+  }
+
+  this->entries.splice(this->entries.begin(), this->entries, it->second);
+
+  return &this->entries.front();
+}
+
+/**
+ * @brief creates entry for source. Least recently used entry reused
+ * if cache is full
+ *
+ * @param source
+ * @returns entry to fill
+ */
+SourceRoutes *RouteCache::insert(nodeid source) {
+  if ((int)this->entries.size() >= this->capacity && !this->entries.empty()) {
+    this->index.erase(this->entries.back().source);
+    this->entries.splice(this->entries.begin(), this->entries,
+                         std::prev(this->entries.end()));
+  } else {
+    this->entries.emplace_front();
+  }
+
+  SourceRoutes *routes = &this->entries.front();
+  routes->source = source;
+  this->index[source] = this->entries.begin();
+
+  return routes;
+}
+
+/**
+ * @brief copies entries. Index rebuilt, it can't point into source list
+ */
+RouteCache &RouteCache::operator=(const RouteCache &cache) {
+  if (this == &cache) {
+    return *this;
+  }
+
+  this->capacity = cache.capacity;
+  this->entries = cache.entries;
+  this->index.clear();
+  for (auto it = this->entries.begin(); it != this->entries.end(); ++it) {
+    this->index[it->source] = it;
+  }
+
+  return *this;
+}
+
+void RouteCache::set_capacity(int capacity) {
+  this->capacity = capacity > 0 ? capacity : 1;
+  while ((int)this->entries.size() > this->capacity) {
+    this->index.erase(this->entries.back().source);
+    this->entries.pop_back();
+  }
+}
+
+/**
+ * @brief inserts edge into node span keeping it sorted by edge id.
+ * Edge with largest id appended without shifting others
+ */
+void Adjacency::add(nodeid id, edgeid edge) {
+  const int size = this->sizes[id];
+  const int capacity = this->capacities[id];
+  if (size == capacity) {
+    const int grown = std::max(capacity * 2, 2);
+    if (this->starts[id] + capacity == (int)this->ids.size()) {
+      // last span grows in place
+      this->ids.resize(this->starts[id] + grown);
+    } else {
+      const int start = this->ids.size();
+      this->ids.resize(start + grown);
+      std::copy_n(this->ids.begin() + this->starts[id], size,
+                  this->ids.begin() + start);
+      this->starts[id] = start;
+      this->holes += capacity;
+    }
+    this->capacities[id] = grown;
+  }
+
+  // new edges usually have largest id, then nothing is shifted
+  const auto first = this->ids.begin() + this->starts[id];
+  const auto last = first + size;
+  const auto it = std::upper_bound(first, last, edge);
+  std::copy_backward(it, last, last + 1);
+  *it = edge;
+  this->sizes[id] = size + 1;
+
+  if (this->holes > this->ids.size() / 2) {
+    this->compact();
+  }
+}
+
+/**
+ * @brief removes edge from node span keeping order of others
+ */
+void Adjacency::remove(nodeid id, edgeid edge) {
+  const auto first = this->ids.begin() + this->starts[id];
+  const auto last = first + this->sizes[id];
+  const auto it = std::find(first, last, edge);
+  if (it == last) {
+    return;
+  }
+
+  std::copy(it + 1, last, it);
+  this->sizes[id] -= 1;
+}
+
+/**
+ * @brief moves all spans together without spare capacity
+ */
+void Adjacency::compact() {
+  size_t used = 0;
+  for (size_t id = 0; id < this->sizes.size(); id++) {
+    used += this->sizes[id];
+  }
+  if (used == this->ids.size()) {
+    return;
+  }
+
+  std::vector<edgeid> ids(used);
+  int start = 0;
+  for (size_t id = 0; id < this->sizes.size(); id++) {
+    std::copy_n(this->ids.begin() + this->starts[id], this->sizes[id],
+                ids.begin() + start);
+    this->starts[id] = start;
+    this->capacities[id] = this->sizes[id];
+    start += this->sizes[id];
+  }
+
+  this->ids.swap(ids);
+  this->holes = 0;
+}
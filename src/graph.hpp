@@ -1,7 +1,9 @@
 #pragma once
+#include "reachability.hpp"
+#include <list>
 #include <map>
+#include <memory>
 #include <vector>
-#include <set>
 
 namespace tyngraph {
 
@@ -25,11 +27,6 @@ public:
     this->_nodeb = -1;
     this->_weight = 1;
 	}
-	Edge(const Edge &e) {
-    this->_nodea = e._nodea;
-    this->_nodeb = e._nodeb;
-    this->_weight = e._weight;
-	}
   nodeid nodea() const { return this->_nodea; }
   nodeid nodeb() const { return this->_nodeb; }
   int weight() const { return this->_weight; }
@@ -54,41 +51,388 @@ public:
   int length() const { return this->_length; }
 };
 
+/**
+ * Contiguous range of edge ids inside adjacency array.
+ * Invalidated by any graph change
+ */
+class EdgeSpan {
+  const edgeid *_begin;
+  const edgeid *_end;
+
+public:
+  EdgeSpan(const edgeid *begin, const edgeid *end) {
+    this->_begin = begin;
+    this->_end = end;
+  }
+  const edgeid *begin() const { return this->_begin; }
+  const edgeid *end() const { return this->_end; }
+  int size() const { return this->_end - this->_begin; }
+  bool empty() const { return this->_begin == this->_end; }
+};
+
+/**
+ * Edge ids grouped by node in one flat array. Every node owns span with
+ * spare capacity, so edges added and removed in place. Span outgrowing its
+ * capacity moved to array end, slots left behind reclaimed by compact()
+ */
+class Adjacency {
+  std::vector<edgeid> ids;
+  // span of node i is ids[starts[i] .. starts[i] + sizes[i]]
+  std::vector<int> starts;
+  std::vector<int> sizes;
+  std::vector<int> capacities;
+  // slots not owned by any span
+  size_t holes;
+
+public:
+  Adjacency() { this->holes = 0; }
+
+  void add_node() {
+    this->starts.push_back(this->ids.size());
+    this->sizes.push_back(0);
+    this->capacities.push_back(0);
+  }
+
+  /**
+   * @brief inserts edge into node span keeping it sorted by edge id.
+   * Edge with largest id appended without shifting others
+   */
+  void add(nodeid id, edgeid edge);
+
+  /**
+   * @brief removes edge from node span keeping order of others
+   */
+  void remove(nodeid id, edgeid edge);
+
+  EdgeSpan span(nodeid id) const {
+    const edgeid *data = this->ids.data() + this->starts[id];
+
+    return EdgeSpan(data, data + this->sizes[id]);
+  }
+
+  /**
+   * @brief moves all spans together without spare capacity
+   */
+  void compact();
+
+  void cleanup() {
+    this->ids.clear();
+    this->starts.clear();
+    this->sizes.clear();
+    this->capacities.clear();
+    this->holes = 0;
+  }
+};
+
 class Node {
 public:
-  std::vector<edgeid> edges;
   std::map<nodeid, Route> routes;
+  bool removed;
 
-  void add_edge(edgeid edge) { this->edges.push_back(edge); }
+  Node() { this->removed = false; }
 
   void add_route(nodeid start, nodeid end, nodeid next, int length) {
     this->routes.insert_or_assign(end, Route(start, end, next, length));
   }
+};
+
+enum class RouteMode {
+  // every node keeps routes to all reachable nodes. Rebuilt on graph change
+  EAGER,
+  // routes searched from source on first route() call and cached
+  LAZY,
+  // routes from all sources built by several threads into one read only
+  // table on commit() or build_route_table(). Graph change drops it, route()
+  // returns -1 until table rebuilt. route() only reads table, so it could
+  // be called from several threads
+  TABLE
+};
+
+/**
+ * Routes from one source to every node, indexed by node id
+ */
+struct SourceRoutes {
+  nodeid source;
+  // next node in path or -1 if node unreachable
+  std::vector<nodeid> next;
+  std::vector<int> length;
+
+  bool reaches(nodeid id) const {
+    return id >= 0 && id < (int)this->next.size() && this->next[id] >= 0;
+  }
+};
+
+/**
+ * Least recently used cache of single source routes
+ */
+class RouteCache {
+  int capacity;
+  std::list<SourceRoutes> entries;
+  std::map<nodeid, std::list<SourceRoutes>::iterator> index;
+
+public:
+  RouteCache(int capacity = 64) { this->capacity = capacity; }
+  RouteCache(const RouteCache &cache) { *this = cache; }
+
+  /**
+   * @brief copies entries. Index rebuilt, it can't point into source list
+   */
+  RouteCache &operator=(const RouteCache &cache);
+
+  /**
+   * @param source
+   * @returns cached routes or nullptr. Marks entry as recently used
+   */
+  SourceRoutes *find(nodeid source);
+
+  /**
+   * @brief creates entry for source. Least recently used entry reused
+   * if cache is full
+   *
+   * @param source
+   * @returns entry to fill
+   */
+  SourceRoutes *insert(nodeid source);
+
+  void set_capacity(int capacity);
+
+  /**
+   * @brief drops entries matching predicate
+   *
+   * @param predicate bool(const SourceRoutes &)
+   */
+  template <typename F> void invalidate(F predicate) {
+    for (auto it = this->entries.begin(); it != this->entries.end();) {
+      if (predicate(*it)) {
+        this->index.erase(it->source);
+        it = this->entries.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  int count() const { return this->entries.size(); }
+
+  void clear() {
+    this->entries.clear();
+    this->index.clear();
+  }
+};
+
+class Graph;
+
+/**
+ * Read only routes from every source. Routes of source i sorted by end
+ * node and stored in [offsets[i], offsets[i + 1])
+ */
+struct RouteTable {
+  std::vector<size_t> offsets;
+  std::vector<nodeid> ends;
+  std::vector<nodeid> next;
+  std::vector<int> length;
+
+  /**
+   * @param a
+   * @param b
+   * @returns next node in path from a to b or -1 if no path found
+   */
+  nodeid route(nodeid a, nodeid b) const;
+
+  /**
+   * @param a
+   * @param b
+   * @returns path length from a to b or -1 if no path found
+   */
+  int length_of(nodeid a, nodeid b) const;
+
+  size_t count() const { return this->ends.size(); }
+
+private:
+  /**
+   * @returns entry index or -1
+   */
+  long find(nodeid a, nodeid b) const;
+};
+
+/**
+ * Dijkstra search with reusable heap and scratch buffers.
+ * Buffers grow to graph size once, repeated searches don't allocate
+ */
+class Pathfinder {
+  struct Step {
+    int length;
+    nodeid node;
+  };
+
+  std::vector<Step> heap;
+  std::vector<int> length;
+  // previous node in path
+  std::vector<nodeid> prev;
+  // first node after source in path
+  std::vector<nodeid> first;
+  // buffers values valid only if marked with current stamp
+  std::vector<unsigned int> reached;
+  std::vector<unsigned int> settled;
+  // nodes in settle order
+  std::vector<nodeid> order;
+  unsigned int stamp;
+  nodeid source;
+
+public:
+  Pathfinder() {
+    this->stamp = 0;
+    this->source = -1;
+  }
+
+  /**
+   * @brief finds shortest paths from a. Source itself counted reached
+   * only through a cycle
+   *
+   * @param graph
+   * @param a source
+   * @param b target to stop at, or -1 to search all nodes
+   */
+  void search(const Graph &graph, nodeid a, nodeid b = -1);
+
+  bool is_reached(nodeid id) const {
+    return id >= 0 && id < (int)this->reached.size() &&
+           this->reached[id] == this->stamp;
+  }
+
+  /**
+   * @returns path length to node or -1 if not reached
+   */
+  int length_to(nodeid id) const {
+    return this->is_reached(id) ? this->length[id] : -1;
+  }
+
+  /**
+   * @returns next node from source to reach node or -1 if not reached
+   */
+  nodeid next_to(nodeid id) const {
+    return this->is_reached(id) ? this->first[id] : -1;
+  }
+
+  /**
+   * @brief writes path from source to node
+   *
+   * @param id
+   * @param nodes result. Cleared and filled with path nodes
+   * @returns path length or -1 if not reached
+   */
+  int path_to(nodeid id, std::vector<nodeid> &nodes) const;
 
-  int count_edges() const { return this->edges.size(); }
+  /**
+   * @returns nodes reached in last search, nearest first
+   */
+  const std::vector<nodeid> &get_settled() const { return this->order; }
 };
 
 class Graph {
-  int guids;
+  // edges started and ended in every node. Patched on every change
+  Adjacency out;
+  Adjacency in;
+  // edges added in batch mode are only recorded
+  bool batching;
+  RouteMode route_mode;
+  RouteCache route_cache;
+  Pathfinder pathfinder;
+  // TABLE mode routes. Replaced only by non const methods
+  std::shared_ptr<const RouteTable> route_table;
+  int route_threads;
+  // built on first reachability query and updated on add_edge after
+  Reachability reachability;
+  bool reachability_valid;
+  // topological order, maintained on add_edge while graph has no cycles
+  std::vector<nodeid> topo_order;
+  std::vector<int> topo_position;
+  bool acyclic;
+  // edges added in batch or removed from cyclic graph. Order has to be
+  // sorted again
+  bool topo_dirty;
+  // traversal scratch. Node visited if marked with current stamp
+  std::vector<unsigned int> marks;
+  unsigned int mark_stamp;
 
 public:
-  std::map<edgeid, Edge> edges;
-  std::map<routeid, Route> routes;
-  std::map<nodeid, Node> nodes;
+  // both indexed by id
+  std::vector<Edge> edges;
+  std::vector<Node> nodes;
 
   Graph() { 
-		this->guids = 0; 
+		this->batching = false;
+		this->route_mode = RouteMode::EAGER;
+		this->route_threads = 0;
+		this->reachability_valid = false;
+		this->acyclic = true;
+		this->topo_dirty = false;
+		this->mark_stamp = 0;
 		this->edges = {};
-		this->routes = {};
 		this->nodes = {};
 	}
 
 	void cleanup() {
 		this->edges.clear();
-		this->routes.clear();
 		this->nodes.clear();
+		this->out.cleanup();
+		this->in.cleanup();
+		this->batching = false;
+		this->route_cache.clear();
+		this->drop_route_table();
+		this->reachability.cleanup();
+		this->reachability_valid = false;
+		this->topo_order.clear();
+		this->topo_position.clear();
+		this->acyclic = true;
+		this->topo_dirty = false;
 	}
 
+  /**
+   * @brief switches routes storage. EAGER mode builds all routes
+   * immediately, LAZY mode drops them and searches on demand,
+   * TABLE mode builds all routes in parallel immediately
+   *
+   * @param mode
+   * @param cache_capacity how many sources LAZY mode keeps
+   */
+  void set_route_mode(RouteMode mode, int cache_capacity = 64);
+
+  RouteMode get_route_mode() const { return this->route_mode; }
+
+  /**
+   * @param threads TABLE mode worker threads count. 0 to use all cores
+   */
+  void set_route_threads(int threads) { this->route_threads = threads; }
+
+  /**
+   * @brief builds routes from every source using several threads
+   * and publishes them as read only table
+   *
+   * @param threads worker threads count. 0 to use all cores
+   */
+  void build_route_table(int threads = 0);
+
+  /**
+   * @returns route table or nullptr if it's not built since last change.
+   * Returned table stays valid after graph change and can be queried from
+   * any thread
+   */
+  std::shared_ptr<const RouteTable> get_route_table() const;
+
+  /**
+   * @brief starts batch mode. Edges added in batch mode only recorded,
+   * routes are not valid until commit() called
+   */
+  void begin_batch();
+
+  bool is_batching() const { return this->batching; }
+
+  /**
+   * @brief leaves batch mode and builds all routes in one pass
+   */
+  void commit();
+
   /**
    * @returns new node id
    */
@@ -112,7 +456,71 @@ public:
    */
   void add_edge_bidir(nodeid a, nodeid b, int weight = 1);
 
-  int count_nodes();
+  /**
+   * @brief removes edge. Rebuilds only routes which could pass it
+   *
+   * @param id
+   * @returns false if there is no such edge
+   */
+  bool remove_edge(edgeid id);
+
+  /**
+   * @brief changes edge weight. Rebuilds only routes which could pass it
+   *
+   * @param id
+   * @param weight
+   * @returns false if there is no such edge
+   */
+  bool set_weight(edgeid id, int weight);
+
+  /**
+   * @brief removes node and all its edges. Removed ids are not reused
+   *
+   * @param id
+   * @returns false if there is no such node
+   */
+  bool remove_node(nodeid id);
+
+  bool has_node(nodeid id) const {
+    return id >= 0 && id < (int)this->nodes.size() && !this->nodes[id].removed;
+  }
+
+  bool has_edge(edgeid id) const {
+    return id >= 0 && id < (int)this->edges.size() &&
+           this->edges[id].nodea() >= 0;
+  }
+
+  /**
+   * @returns node ids range size. Includes removed nodes
+   */
+  int count_nodes() const;
+
+  /**
+   * @returns edge ids range size. Includes removed edges
+   */
+  int count_edges();
+
+  /**
+   * @brief edges started in node
+   *
+   * @param id node id
+   * @returns span of edge ids. Valid until next graph change
+   */
+  EdgeSpan outputs(nodeid id) const { return this->out.span(id); }
+
+  /**
+   * @brief edges ended in node
+   *
+   * @param id node id
+   * @returns span of edge ids. Valid until next graph change
+   */
+  EdgeSpan inputs(nodeid id) const { return this->in.span(id); }
+
+  /**
+   * @brief sorts nodes, so const queries could be used. Prepared graph
+   * can be read from several threads
+   */
+  void prepare();
 
   /**
    * @brief returns next node required to reach b form a
@@ -123,8 +531,181 @@ public:
    */
   nodeid route(nodeid a, nodeid b);
 
+  /**
+   * @brief const version of route(). Safe to call from several threads
+   * in EAGER and TABLE modes while graph isn't changed. LAZY mode searches
+   * every call without caching
+   */
+  nodeid route(nodeid a, nodeid b) const;
+
+  /**
+   * @brief O(1) check using transitive closure index.
+   * Index built on first call
+   *
+   * @param a
+   * @param b
+   * @returns true if there is path from a to b
+   */
+  bool is_reachable(nodeid a, nodeid b);
+
+  /**
+   * @brief calls callback(nodeid) for every node reachable from id
+   */
+  template <typename F> void for_each_downstream(nodeid id, F callback) {
+    this->get_reachability()->for_each_descendant(id, callback);
+  }
+
+  /**
+   * @brief calls callback(nodeid) for every node which reaches id
+   */
+  template <typename F> void for_each_upstream(nodeid id, F callback) {
+    this->get_reachability()->for_each_ancestor(id, callback);
+  }
+
+  /**
+   * @returns false if graph has cycles
+   */
+  bool is_acyclic();
+
+  /**
+   * @brief checks if edge from a to b would close a cycle. In batch mode
+   * whole graph sorted first, use break_cycles() on commit instead
+   *
+   * @param a
+   * @param b
+   */
+  bool creates_cycle(nodeid a, nodeid b);
+
+  /**
+   * @brief removes edges which close cycles. Edges checked in id order,
+   * so same edges removed as if every one checked by creates_cycle() before
+   * adding. Whole graph sorted once, edges placed one by one only if it
+   * has cycles
+   *
+   * @param first edges with smaller ids are kept. Graph without them has
+   * to be acyclic
+   * @returns removed edges ids
+   */
+  std::vector<edgeid> break_cycles(edgeid first);
+
+  /**
+   * @brief all nodes ordered so every edge goes forward.
+   * Valid only if is_acyclic()
+   */
+  const std::vector<nodeid> &topological_order();
+
+  /**
+   * @brief const version of topological_order(). Graph has to be prepared
+   */
+  const std::vector<nodeid> &topological_order() const {
+    return this->topo_order;
+  }
+
+  /**
+   * @returns node index in topological_order()
+   */
+  int topological_position(nodeid id);
+
+  /**
+   * @brief const version of topological_position(). Graph has to be
+   * prepared
+   */
+  int topological_position(nodeid id) const { return this->topo_position[id]; }
+
+  /**
+   * @returns transitive closure index. Built if outdated
+   */
+  const Reachability *get_reachability();
+
+  /**
+   * @brief finds shortest path from a to b
+   *
+   * @param a
+   * @param b
+   * @param nodes result. Cleared and filled with path nodes from a to b.
+   * Reuse same vector to avoid allocations
+   * @returns total path length or -1 if no path found
+   */
+  int path(nodeid a, nodeid b, std::vector<nodeid> &nodes);
+
 private:
-  void build(nodeid a, std::set<nodeid> &traversed);
+  /**
+   * @brief rebuilds routes of node from its direct outputs routes
+   *
+   * @param a
+   * @returns true if any route of node changed
+   */
+  bool build(nodeid a);
+
+  /**
+   * @brief rebuilds routes of nodes in list and all nodes which routes
+   * depends on changed ones
+   *
+   * @param worklist nodes to rebuild. Consumed
+   */
+  void build(std::vector<nodeid> &worklist);
+
+  /**
+   * @brief rebuilds routes of all nodes
+   */
+  void build();
+
+  /**
+   * @brief drops cached routes which could get shorter with new edge
+   */
+  void invalidate_added(const Edge &edge);
+
+  /**
+   * @brief drops cached routes which could pass removed edge
+   */
+  void invalidate_removed(const Edge &edge);
+
+  /**
+   * @brief clears and rebuilds routes of nodes and all their ancestors
+   *
+   * @param starts
+   */
+  void rebuild_upstream(const std::vector<nodeid> &starts);
+
+  void drop_route_table();
+
+  /**
+   * @brief starts new traversal. All nodes become unmarked
+   */
+  void reset_marks();
+
+  /**
+   * @returns false if node was already marked in this traversal
+   */
+  bool mark(nodeid id) {
+    if (this->marks[id] == this->mark_stamp) {
+      return false;
+    }
+    this->marks[id] = this->mark_stamp;
+
+    return true;
+  }
+
+  /**
+   * @brief moves nodes so edge from a to b goes forward in topological
+   * order. Only nodes between b and a positions visited
+   *
+   * @returns false if edge closes a cycle
+   */
+  bool reorder(nodeid a, nodeid b);
+
+  /**
+   * @brief sorts all nodes from scratch
+   */
+  void sort_topologically();
+
+  /**
+   * @brief finds shortest routes from source to all nodes
+   *
+   * @param a source
+   * @param routes result
+   */
+  void search(nodeid a, SourceRoutes *routes);
 };
 
 } // namespace tyngraph
@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdio>
+#include <string>
+
+/**
+ * Counts of time samples in power of two millisecond buckets:
+ * below 1 ms, below 2 ms ... and everything above last limit
+ */
+class TimeHistogram {
+  static constexpr int BUCKETS = 8;
+  int counts[BUCKETS] = {};
+  int total = 0;
+  double max = 0;
+
+public:
+  /**
+   * @param ms sample in milliseconds
+   */
+  void add(double ms) {
+    int bucket = 0;
+    while (bucket < BUCKETS - 1 && ms >= this->limit(bucket)) {
+      bucket += 1;
+    }
+    this->counts[bucket] += 1;
+    this->total += 1;
+    if (ms > this->max) {
+      this->max = ms;
+    }
+  }
+
+  /**
+   * @returns {double} upper bound of bucket in milliseconds
+   */
+  double limit(int bucket) const { return (double)(1 << bucket); }
+
+  int count(int bucket) const { return this->counts[bucket]; }
+  int get_total() const { return this->total; }
+  double get_max() const { return this->max; }
+
+  /**
+   * @returns one line summary like "<1ms 590, <2ms 8, ... max 3.2ms"
+   */
+  std::string to_string() const {
+    std::string line;
+    char buffer[32];
+    for (int bucket = 0; bucket < BUCKETS; bucket++) {
+      if (bucket < BUCKETS - 1) {
+        snprintf(buffer, sizeof(buffer), "<%gms %d, ", this->limit(bucket),
+                 this->counts[bucket]);
+      } else {
+        snprintf(buffer, sizeof(buffer), ">=%gms %d, ",
+                 this->limit(bucket - 1), this->counts[bucket]);
+      }
+      line += buffer;
+    }
+    snprintf(buffer, sizeof(buffer), "max %.1fms", this->max);
+    line += buffer;
+
+    return line;
+  }
+};
@@ -1,5 +1,8 @@
 #include "raylib.h"
+#include <algorithm>
+#include <cstdint>
 #include <map>
+#include <vector>
 #include <raymath.h>
 
 #if defined(PLATFORM_WEB)
@@ -14,8 +17,12 @@
 
 // #include <iostream>
 // #include <ostream>
+#include "descriptions.hpp"
 #include "dukscript.hpp"
 #include "dust.hpp"
+#include "histogram.hpp"
+#include "planner.hpp"
+#include "stats.hpp"
 #include "skillicon.hpp"
 #include "skilltree.hpp"
 
@@ -23,10 +30,26 @@ using namespace tynskills;
 
 Skilltree *skilltree;
 Dukscript *dukscript;
+DescriptionCache *descriptions;
+// script hooks budget, keeps slow bind functions from stalling frame
+const double script_budget_ms = 4.0;
+// wall time of draw() per frame, logged on dispose
+TimeHistogram frame_times;
 std::map<nodeid, Skillicon> skillicons;
 long config_file_timestamp = 0;
 const char *config_filename = RES_PATH "skills.json";
+long script_file_timestamp = 0;
+const char *script_filename = RES_PATH "skills.js";
 int points_spent = 0;
+// branches active status, updated by tree events
+std::vector<uint8_t> branches_active;
+// branches upgrade of leaf hovered in previous frame would activate
+std::vector<uint8_t> branches_preview;
+nodeid hovered_leaf = -1;
+UnlockPlanner unlock_planner;
+StatAggregator *stats;
+// script function handle of every leaf bind, -1 if none
+std::vector<int> leaf_functions;
 
 void UpdateDrawFrame(void);
 bool parse_config(Skilltree *skilltree);
@@ -40,31 +63,41 @@ void init() {
 
   dukscript->eval("print('Dukscript initialized');");
 
-  dukscript->eval_file(RES_PATH "skills.js");
+  script_file_timestamp = GetFileModTime(script_filename);
+  dukscript->eval_file_cached(script_filename);
+  dukscript->set_call_budget(script_budget_ms);
+  descriptions = new DescriptionCache(dukscript);
   points_spent = 0;
 
   parse_config(skilltree);
+
+  // sync once, then follow tree events
+  branches_active.clear();
+  for (const auto &[id, icon] : skillicons) {
+    const Leaf *leaf = skilltree->get_leaf(id);
+    for (const auto &eid : skilltree->outputs(id)) {
+      branches_active.resize(std::max((int)branches_active.size(), eid + 1));
+      branches_active[eid] = skilltree->get_branch(eid)->is_active(leaf);
+    }
+  }
+  stats = new StatAggregator(skilltree);
+  skilltree->subscribe([](const TreeEvent *events, int count) {
+    for (int i = 0; i < count; i++) {
+      if (events[i].type == TreeEventType::BRANCH_ACTIVATED) {
+        branches_active[events[i].id] = true;
+      } else if (events[i].type == TreeEventType::BRANCH_DEACTIVATED) {
+        branches_active[events[i].id] = false;
+      }
+    }
+  });
   return;
 }
 
 Vector2 pad = {16.0, 16.0};
 
 const char *get_leaf_desription(Leaf *l) {
-  const char *str = NULL;
-  const char *funcname = l->get_bind().c_str();
-  int rc = dukscript->call(funcname, [=]() {
-    dukscript->push_int(l->get_points());
-    dukscript->push_int(l->get_maxpoints());
-
-    return 2;
-  });
-
-  if (rc) {
-    str = dukscript->get_string();
-    dukscript->pop(2);
-  }
-
-  return str;
+  return descriptions->get(leaf_functions[l->get_id()], l->get_points(),
+                           l->get_maxpoints());
 }
 
 void draw() {
@@ -74,25 +107,29 @@ void draw() {
   bool clicked_second = IsMouseButtonPressed(MOUSE_BUTTON_RIGHT);
 
   Leaf *selected_leaf = nullptr;
+  nodeid locked_leaf = -1;
+
+  branches_preview.assign(branches_active.size(), false);
+  if (hovered_leaf >= 0) {
+    for (const TreeEvent &event : skilltree->preview(hovered_leaf, 1)) {
+      if (event.type == TreeEventType::BRANCH_ACTIVATED &&
+          event.id < (int)branches_preview.size()) {
+        branches_preview[event.id] = true;
+      }
+    }
+  }
 
   // draw branches in first pass (z-index 0)
   for (auto &[id, icon] : skillicons) {
-    Leaf *leaf = skilltree->get_leaf(id);
-    Node *node = skilltree->get_node(id);
     const Vector2 center = icon.get_center(pad);
 
-    for (const auto &eid : node->edges) {
+    for (const auto &eid : skilltree->outputs(id)) {
       const Edge *edge = skilltree->get_edge(eid);
-      if (edge->nodea() != id) {
-        continue;
-      }
-
-      const Branch *branch = skilltree->get_branch(eid);
       Skillicon *iconb = &skillicons[edge->nodeb()];
       const Vector2 centerb = iconb->get_center(pad);
 
-      bool active = branch->is_active(leaf);
-      Color color = active ? RED : GRAY;
+      bool active = branches_active[eid];
+      Color color = active ? RED : branches_preview[eid] ? ORANGE : GRAY;
       DrawLineEx(center, centerb, 4.0, color);
     }
   }
@@ -107,10 +144,13 @@ void draw() {
     bool collision = CheckCollisionPointRec(mouse, rect) && leaf->is_active();
     if (collision) {
       selected_leaf = leaf;
+    } else if (CheckCollisionPointRec(mouse, rect)) {
+      locked_leaf = id;
     }
     // draw icon
     icon.draw(leaf, rect, collision);
   }
+  hovered_leaf = selected_leaf ? selected_leaf->get_id() : -1;
 
   // upgrade logic, user interact.
   // Icon draw will be delayed on one frame
@@ -123,12 +163,32 @@ void draw() {
     }
 
     if (direction != 0) {
-      const int delta = selected_leaf->upgrade(direction);
-      points_spent += delta;
-      points_spent += skilltree->refresh_leaf(selected_leaf->get_id());
+      points_spent +=
+          skilltree->upgrade_leaf(selected_leaf->get_id(), direction);
     }
   }
 
+  // unlock cost preview of hovered inactive leaf
+  if (locked_leaf >= 0) {
+    UnlockPlan plan;
+    const char *text = "can't be unlocked";
+    if (unlock_planner.plan(*skilltree->get_definition(),
+                            skilltree->get_state(), locked_leaf, -1, plan)) {
+      text = TextFormat("%d points to unlock", plan.points);
+    }
+    DrawText(text, mouse.x + 8, mouse.y + 8, fontsize, BLACK);
+  }
+
+  // undo/redo: ctrl+z, ctrl+y or ctrl+shift+z
+  const bool control =
+      IsKeyDown(KEY_LEFT_CONTROL) || IsKeyDown(KEY_RIGHT_CONTROL);
+  const bool shift = IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT);
+  if (control && IsKeyPressed(KEY_Z) && !shift) {
+    points_spent += skilltree->undo();
+  } else if (control && (IsKeyPressed(KEY_Y) || IsKeyPressed(KEY_Z))) {
+    points_spent += skilltree->redo();
+  }
+
   // draw leaf text fetchet from js
   if (selected_leaf != nullptr && selected_leaf->has_bind()) {
     const auto bind = selected_leaf->get_bind();
@@ -152,17 +212,33 @@ void draw() {
   DrawText(TextFormat("%d spent", points_spent), 8,
            GetScreenHeight() - fontsize - 8, fontsize, BLACK);
 
+  const SkilltreeDefinition *definition = skilltree->read_definition();
+  for (int i = 0; i < stats->count(); i++) {
+    DrawText(TextFormat("%s %.1f", definition->get_stat_name(i),
+                        stats->get(i)),
+             8, 8 + i * (fontsize + 4), fontsize, BLACK);
+  }
+
   DrawCircle(mouse.x, mouse.y, 8, WHITE);
   DrawCircle(mouse.x, mouse.y, 6, BLACK);
 }
 
 void dispose() {
+  delete stats;
   skilltree->cleanup();
   skillicons.clear();
 
   // todo: texture uloading
 
   delete skilltree;
+  TraceLog(LOG_INFO, TextFormat("Descriptions cache: %d hits, %d misses",
+                                descriptions->get_hits(),
+                                descriptions->get_misses()));
+  delete descriptions;
+  TraceLog(LOG_INFO, TextFormat("Draw wall times: %s, script timeouts %d",
+                                frame_times.to_string().c_str(),
+                                dukscript->get_timeouts()));
+  frame_times = TimeHistogram();
   delete dukscript;
 }
 
@@ -200,14 +276,17 @@ int main() {
 }
 
 void UpdateDrawFrame(void) {
-  if (config_file_timestamp != GetFileModTime(config_filename)) {
+  if (config_file_timestamp != GetFileModTime(config_filename) ||
+      script_file_timestamp != GetFileModTime(script_filename)) {
     dispose();
     init();
   }
 
   BeginDrawing();
   ClearBackground(RAYWHITE);
+  const double start = GetTime();
   draw();
+  frame_times.add((GetTime() - start) * 1000);
   EndDrawing();
 }
 
@@ -269,23 +348,31 @@ bool parse_config(Skilltree *skilltree) {
       }
       dukscript->pop(); // pop branches
     }
+    // "stats": { "name": value per point }
+    if (dukscript->read_object("stats")) {
+      dukscript->enum_object();
+      while (dukscript->next()) {
+        ci.info.modifiers.push_back(
+            {dukscript->get_string(-2), dukscript->get_float(-1)});
+        dukscript->pop(2); // pop key, value
+      }
+      dukscript->pop(2); // pop enum, stats
+    }
 
     dukscript->pop(2); // pop key, value
 
     const BranchProgressMode mode = name_modes[smode];
-    Skillinfo s = {.points = points,
-                   .maxpoints = maxpoints,
-                   .active = active,
-                   .mode = mode,
-                   .name = key,
-                   .bind = bind};
-
-    ci.info = s;
+    ci.info.points = points;
+    ci.info.maxpoints = maxpoints;
+    ci.info.active = active;
+    ci.info.mode = mode;
+    ci.info.name = key;
+    ci.info.bind = bind;
     ci.shift = {sx, sy};
     ci.follows = follows;
     ci.icon_name = icon_name;
 
-    construct_infos.push_back(ci);
+    construct_infos.push_back(std::move(ci));
   }
 
   // enumerator pop
@@ -294,53 +381,110 @@ bool parse_config(Skilltree *skilltree) {
 
   // --- adding skills into tree
 
-  std::map<std::string, nodeid> name_to_id;
   Vector2 cell = {128.0 + 16.0, 128.0 + 16.0};
 
-  // create leafs icons
+  // create leafs
+  leaf_functions.clear();
+  std::vector<nodeid> leafids;
   for (const auto &ci : construct_infos) {
     const int leafid = skilltree->add_leaf();
-    name_to_id[ci.info.name] = leafid;
     Leaf *leaf = skilltree->get_leaf(leafid);
     leaf->setup(ci.info);
+    leafids.push_back(leafid);
 
-    // pos
-    Vector2 pos = {cell.x * ci.shift.x, cell.y * ci.shift.y};
-    if (ci.follows.length()) {
-      nodeid originid = name_to_id[ci.follows];
-      Skillicon *icon = &skillicons[originid];
-      const Vector2 origin = icon->get_pos();
+    // binds resolved once, so hover calls skip global lookup
+    leaf_functions.resize(leafid + 1, -1);
+    if (leaf->has_bind()) {
+      leaf_functions[leafid] = dukscript->resolve(leaf->get_bind());
+    }
+  }
+
+  // follows resolved after all leafs added, so any leaf could be origin.
+  // Indexed by construct info, -1 if icon placed by own shift only
+  std::vector<int> origins(construct_infos.size(), -1);
+  for (size_t i = 0; i < construct_infos.size(); i++) {
+    const auto &ci = construct_infos[i];
+    if (!ci.follows.length()) {
+      continue;
+    }
+
+    const nodeid originid = skilltree->read_definition()->find_leaf(ci.follows);
+    if (originid < 0) {
+      TraceLog(LOG_ERROR,
+               TextFormat("Config Error: '%s' follows unknown leaf '%s'",
+                          ci.info.name.c_str(), ci.follows.c_str()));
+      continue;
+    }
+    origins[i] = std::find(leafids.begin(), leafids.end(), originid) -
+                 leafids.begin();
+  }
 
-      pos.x += origin.x;
-      pos.y += origin.y;
+  // create leafs icons. Icon placed by shifts of all its follows chain
+  for (size_t i = 0; i < construct_infos.size(); i++) {
+    const auto &ci = construct_infos[i];
+    Vector2 pos = {cell.x * ci.shift.x, cell.y * ci.shift.y};
+    int origin = origins[i];
+    size_t steps = 0;
+    for (; origin >= 0 && steps < construct_infos.size(); steps++) {
+      pos.x += cell.x * construct_infos[origin].shift.x;
+      pos.y += cell.y * construct_infos[origin].shift.y;
+      origin = origins[origin];
+    }
+    if (origin >= 0) {
+      TraceLog(LOG_ERROR,
+               TextFormat("Config Error: follows of '%s' form a loop",
+                          ci.info.name.c_str()));
     }
 
     Texture texture =
         LoadTexture(TextFormat(RES_PATH "icons/%s.png", ci.icon_name.c_str()));
-    skillicons[leafid] = Skillicon(texture, pos, leafid);
+    skillicons[leafids[i]] = Skillicon(texture, pos, leafids[i]);
   }
 
-  // create branches
+  // create branches. Config names of every branch kept to report cycles
+  // found on commit
+  std::map<edgeid, std::pair<const std::string *, const std::string *>>
+      batch_branches;
+  skilltree->begin_batch();
   for (const auto &ci : construct_infos) {
-    nodeid leafa = name_to_id[ci.info.name];
+    nodeid leafa = skilltree->read_definition()->find_leaf(ci.info.name);
 
     for (const auto &branch : ci.branches) {
-      nodeid leafb = -1;
+      std::string_view name = branch;
       auto delimiter_find = branch.find(':');
       BranchProgressMode mode = BranchProgressMode::MAXIMUM;
       if (delimiter_find != std::string::npos) {
-        auto name = branch.substr(0, delimiter_find);
-        auto smode = branch.substr(delimiter_find + 1, branch.length());
-        mode = name_modes[smode];
-        leafb = name_to_id[name];
-      } else {
-        leafb = name_to_id[branch];
+        name = name.substr(0, delimiter_find);
+        mode = name_modes[branch.substr(delimiter_find + 1)];
+      }
+      const nodeid leafb = skilltree->read_definition()->find_leaf(name);
+      if (leafb < 0) {
+        TraceLog(LOG_ERROR,
+                 TextFormat("Config Error: branch '%s' of '%s' not found",
+                            branch.c_str(), ci.info.name.c_str()));
+        continue;
       }
 
       // in config branches reversed - they listed in INPUT leafs
-      skilltree->add_branch(leafb, leafa, mode);
+      const edgeid id = skilltree->add_branch(leafb, leafa, mode);
+      if (id < 0) {
+        TraceLog(LOG_ERROR,
+                 TextFormat("Config Error: branch '%s' of '%s' creates cycle",
+                            branch.c_str(), ci.info.name.c_str()));
+      } else {
+        batch_branches[id] = {&branch, &ci.info.name};
+      }
     }
   }
+  for (const edgeid &id : skilltree->commit()) {
+    const auto &[branch, name] = batch_branches[id];
+    TraceLog(LOG_ERROR,
+             TextFormat("Config Error: branch '%s' of '%s' creates cycle",
+                        branch->c_str(), name->c_str()));
+  }
+
+  // incremental refresh relies on consistent initial state
+  skilltree->refresh();
 
   return true;
 }
@@ -0,0 +1,255 @@
+#include "planner.hpp"
+#include <algorithm>
+
+using namespace tynskills;
+
+/**
+ * @brief min points to activate every leaf, ignoring points shared between
+ * inputs. Leafs walked in topological order, so inputs are ready
+ */
+void UnlockPlanner::compute_lower_bounds() {
+  const Graph &graph = this->definition->graph;
+  this->lower_bounds.assign(this->definition->count_leafs(), UNREACHABLE);
+
+  for (const nodeid id : graph.topological_order()) {
+    if (!graph.has_node(id)) {
+      continue;
+    }
+    if (this->state->active[id]) {
+      this->lower_bounds[id] = 0;
+      continue;
+    }
+
+    const bool all =
+        this->definition->modes[id] == BranchProgressMode::MAXIMUM;
+    int bound = all ? 0 : UNREACHABLE;
+    for (const auto &eid : graph.inputs(id)) {
+      const Edge &edge = graph.edges[eid];
+      const nodeid a = edge.nodea();
+      int cost = UNREACHABLE;
+      if (edge.weight() <= this->definition->maxpoints[a] &&
+          this->lower_bounds[a] < UNREACHABLE) {
+        cost = this->lower_bounds[a] +
+               std::max(0, edge.weight() - this->state->points[a]);
+      }
+
+      bound = all ? std::max(bound, cost) : std::min(bound, cost);
+    }
+
+    this->lower_bounds[id] = std::min(bound, (int)UNREACHABLE);
+  }
+}
+
+int UnlockPlanner::raise(nodeid id, int points) {
+  const int was = this->planned[id];
+  if (was >= points) {
+    return 0;
+  }
+
+  this->raises.push_back({id, was});
+  this->planned[id] = points;
+
+  return points - was;
+}
+
+void UnlockPlanner::restore(size_t raises) {
+  while (this->raises.size() > raises) {
+    const Raise &raise = this->raises.back();
+    this->planned[raise.id] = raise.points;
+    this->raises.pop_back();
+  }
+}
+
+bool UnlockPlanner::push_goal(nodeid id) {
+  if (this->state->active[id]) {
+    return false;
+  }
+
+  const int position = this->definition->graph.topological_position(id);
+  uint64_t &word = this->goals[position >> 6];
+  const uint64_t bit = (uint64_t)1 << (position & 63);
+  if (word & bit) {
+    return false;
+  }
+
+  word |= bit;
+  this->goals_count += 1;
+  return true;
+}
+
+void UnlockPlanner::erase_goal(nodeid id) {
+  const int position = this->definition->graph.topological_position(id);
+  this->goals[position >> 6] &= ~((uint64_t)1 << (position & 63));
+  this->goals_count -= 1;
+}
+
+int UnlockPlanner::top_goal(int below) const {
+  if (below <= 0) {
+    return -1;
+  }
+
+  int w = (below - 1) >> 6;
+  // bits of first word at and above below dropped
+  uint64_t bits = this->goals[w];
+  const int shift = 63 - ((below - 1) & 63);
+  bits = (bits << shift) >> shift;
+  while (true) {
+    if (bits) {
+      return w * 64 + 63 - __builtin_clzll(bits);
+    }
+    if (--w < 0) {
+      return -1;
+    }
+    bits = this->goals[w];
+  }
+}
+
+void UnlockPlanner::save_plan(int cost) {
+  const Graph &graph = this->definition->graph;
+  this->best = cost;
+  this->best_upgrades.clear();
+
+  for (const Raise &raise : this->raises) {
+    const nodeid id = raise.id;
+    if (this->marks[id]) {
+      continue;
+    }
+
+    this->marks[id] = true;
+    this->best_upgrades.push_back(
+        {id, this->planned[id] - this->state->points[id]});
+  }
+  for (const LeafUpgrade &upgrade : this->best_upgrades) {
+    this->marks[upgrade.id] = false;
+  }
+
+  std::sort(this->best_upgrades.begin(), this->best_upgrades.end(),
+            [&graph](const LeafUpgrade &l, const LeafUpgrade &r) {
+              return graph.topological_position(l.id) <
+                     graph.topological_position(r.id);
+            });
+}
+
+/**
+ * @brief expands goal with highest topological position. Its outputs are
+ * expanded already, so all points it has to give are planned
+ *
+ * @param cost points planned so far
+ * @param bound lower bound of complete plan cost
+ */
+void UnlockPlanner::search(int cost, int bound, int below) {
+  if (std::max(cost, bound) >= this->best) {
+    return;
+  }
+  if (this->goals_count == 0) {
+    this->save_plan(cost);
+    this->complete = true;
+    return;
+  }
+  if (this->complete && this->expansions >= this->limit) {
+    this->truncated = true;
+    return;
+  }
+  this->expansions += 1;
+
+  const Graph &graph = this->definition->graph;
+  const int position = this->top_goal(below);
+  const nodeid id = graph.topological_order()[position];
+  this->erase_goal(id);
+
+  const size_t raises = this->raises.size();
+  const size_t added = this->added.size();
+  const size_t choices = this->choices.size();
+
+  if (this->definition->modes[id] == BranchProgressMode::MAXIMUM) {
+    // every input branch has to be active
+    int total = cost;
+    for (const auto &eid : graph.inputs(id)) {
+      const nodeid a = graph.edges[eid].nodea();
+      total += this->raise(a, graph.edges[eid].weight());
+      if (this->push_goal(a)) {
+        this->added.push_back(a);
+      }
+    }
+    this->search(total, bound, position);
+  } else {
+    // one input branch is enough, cheapest estimate tried first
+    for (const auto &eid : graph.inputs(id)) {
+      const nodeid a = graph.edges[eid].nodea();
+      const int weight = graph.edges[eid].weight();
+      if (weight > this->definition->maxpoints[a] ||
+          this->lower_bounds[a] >= UNREACHABLE) {
+        continue;
+      }
+
+      const int estimate = std::max(0, weight - this->planned[a]) +
+                           this->lower_bounds[a];
+      this->choices.push_back({estimate, eid});
+    }
+    std::sort(this->choices.begin() + choices, this->choices.end());
+
+    for (size_t i = choices; i < this->choices.size(); i++) {
+      const edgeid eid = this->choices[i].second;
+      const nodeid a = graph.edges[eid].nodea();
+      const int total = cost + this->raise(a, graph.edges[eid].weight());
+      const bool pushed = this->push_goal(a);
+
+      this->search(total, std::max(bound, this->lower_bounds[a]), position);
+
+      if (pushed) {
+        this->erase_goal(a);
+      }
+      this->restore(raises);
+    }
+  }
+
+  for (size_t i = added; i < this->added.size(); i++) {
+    this->erase_goal(this->added[i]);
+  }
+  this->added.resize(added);
+  this->choices.resize(choices);
+  this->restore(raises);
+  this->push_goal(id);
+}
+
+bool UnlockPlanner::plan(const SkilltreeDefinition &definition,
+                         const SkilltreeState &state, nodeid target,
+                         int budget, UnlockPlan &plan) {
+  plan = UnlockPlan();
+  if (!definition.graph.has_node(target)) {
+    return false;
+  }
+
+  this->definition = &definition;
+  this->state = &state;
+  this->budget = budget;
+  this->expansions = 0;
+  this->truncated = false;
+  this->complete = false;
+  // plans over budget never saved
+  this->best = budget >= 0 ? budget + 1 : UNREACHABLE;
+  this->best_upgrades.clear();
+  this->planned = state.points;
+  this->marks.assign(definition.count_leafs(), false);
+  this->raises.clear();
+  this->added.clear();
+  this->choices.clear();
+  this->goals.assign((definition.count_leafs() + 63) / 64, 0);
+  this->goals_count = 0;
+
+  this->compute_lower_bounds();
+  const int bound = this->lower_bounds[target];
+  if (bound < this->best) {
+    this->push_goal(target);
+    this->search(0, bound, definition.count_leafs());
+  }
+
+  plan.found = this->best < (budget >= 0 ? budget + 1 : UNREACHABLE);
+  plan.optimal = !this->truncated;
+  if (plan.found) {
+    plan.points = this->best;
+    plan.upgrades = this->best_upgrades;
+  }
+
+  return plan.found;
+}
@@ -0,0 +1,122 @@
+#pragma once
+#include "skilltree.hpp"
+#include <climits>
+#include <cstdint>
+#include <vector>
+
+namespace tynskills {
+
+/**
+ * Upgrades required to activate target leaf
+ */
+struct UnlockPlan {
+  // target can be activated within budget
+  bool found = false;
+  // search finished, no cheaper plan exists
+  bool optimal = false;
+  // total points to add
+  int points = 0;
+  // leafs to upgrade, inputs first
+  std::vector<LeafUpgrade> upgrades;
+};
+
+/**
+ * Finds cheapest set of upgrades which activates target leaf.
+ *
+ * Branch-and-bound over target ancestors: leafs with ANY or MINIMUM mode
+ * choose one input branch, MAXIMUM mode leafs need all of them. Branch edge
+ * weight is points its input leaf needs. Per-leaf lower bounds memoized
+ * once per query order choices and prune search. First descent is greedy
+ * plan, search stops after expansion limit with best plan found so far
+ */
+class UnlockPlanner {
+  static constexpr int UNREACHABLE = INT_MAX / 4;
+
+  const SkilltreeDefinition *definition;
+  const SkilltreeState *state;
+  // points planned for every leaf, starts from state points
+  std::vector<int> planned;
+  // min cost to activate leaf from given state, UNREACHABLE if impossible
+  std::vector<int> lower_bounds;
+  // leafs to activate, bit per topological position. Expanded goal always
+  // has highest position, so next one searched below it only
+  std::vector<uint64_t> goals;
+  int goals_count;
+  // planned points changes log, used for backtracking
+  struct Raise {
+    nodeid id;
+    int points;
+  };
+  std::vector<Raise> raises;
+  // search stacks shared by all levels: input choices and goals added
+  std::vector<std::pair<int, edgeid>> choices;
+  std::vector<nodeid> added;
+  std::vector<uint8_t> marks;
+  // found plan, search stops after limit expansions since then
+  bool complete;
+
+  int limit;
+  int expansions;
+  bool truncated;
+  int budget;
+  int best;
+  std::vector<LeafUpgrade> best_upgrades;
+
+  void compute_lower_bounds();
+  void search(int cost, int bound, int below);
+  void save_plan(int cost);
+
+  /**
+   * @brief plans points of leaf. Logged for backtracking
+   * @returns {int} points added to plan
+   */
+  int raise(nodeid id, int points);
+
+  /**
+   * @brief reverts planned points to log size
+   */
+  void restore(size_t raises);
+
+  /**
+   * @brief adds leaf to goals if not there yet
+   * @returns true if added
+   */
+  bool push_goal(nodeid id);
+  void erase_goal(nodeid id);
+
+  /**
+   * @returns highest goal position below given one or -1
+   */
+  int top_goal(int below) const;
+
+public:
+  /**
+   * @param limit max search expansions per query after first plan found
+   */
+  UnlockPlanner(int limit = 256) {
+    this->definition = nullptr;
+    this->state = nullptr;
+    this->limit = limit;
+    this->expansions = 0;
+    this->truncated = false;
+    this->complete = false;
+    this->goals_count = 0;
+    this->budget = -1;
+    this->best = UNREACHABLE;
+  }
+
+  void set_limit(int limit) { this->limit = limit; }
+
+  /**
+   * @param definition prepared definition
+   * @param state current allocation
+   * @param target leaf to activate
+   * @param budget max points to spend. -1 for no limit
+   * @param plan result
+   * @returns {bool} false if target can't be activated within budget
+   */
+  bool plan(const SkilltreeDefinition &definition, const SkilltreeState &state,
+            nodeid target, int budget, UnlockPlan &plan);
+};
+
+} // namespace tynskills
@@ -0,0 +1,164 @@
+#include "reachability.hpp"
+#include "graph.hpp"
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+using namespace tyngraph;
+
+/**
+ * @brief dst |= src for whole row. AVX2 path built with SKILLTREE_AVX2
+ * cmake option
+ */
+static void or_row(uint64_t *dst, const uint64_t *src, int words) {
+  int i = 0;
+#if defined(__AVX2__)
+  for (; i + 4 <= words; i += 4) {
+    const __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+    const __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+    _mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(d, s));
+  }
+#endif
+  for (; i < words; i++) {
+    dst[i] |= src[i];
+  }
+}
+
+static void set_bit(uint64_t *row, nodeid id) {
+  row[id >> 6] |= (uint64_t)1 << (id & 63);
+}
+
+/**
+ * @brief resizes rows to fit nodes count. Keeps rows content
+ */
+void Reachability::reserve(int count) {
+  const int words = (count + 63) / 64;
+  if (words <= this->stride) {
+    return;
+  }
+
+  // grow rows twice to keep add_node amortized
+  const int stride = std::max(words, this->stride * 2);
+  std::vector<uint64_t> descendants((size_t)count * stride, 0);
+  std::vector<uint64_t> ancestors((size_t)count * stride, 0);
+  for (nodeid id = 0; id < this->count; id++) {
+    std::copy_n(this->descendants_row(id), this->stride,
+                descendants.begin() + (size_t)id * stride);
+    std::copy_n(this->ancestors_row(id), this->stride,
+                ancestors.begin() + (size_t)id * stride);
+  }
+
+  this->stride = stride;
+  this->descendants.swap(descendants);
+  this->ancestors.swap(ancestors);
+}
+
+/**
+ * @brief adds empty row for new node
+ */
+void Reachability::add_node() {
+  this->reserve(this->count + 1);
+  this->count += 1;
+  this->descendants.resize((size_t)this->count * this->stride, 0);
+  this->ancestors.resize((size_t)this->count * this->stride, 0);
+}
+
+/**
+ * @brief builds index from scratch. Rows filled in topological order
+ *
+ * @param graph
+ */
+void Reachability::build(Graph &graph) {
+  const int count = graph.count_nodes();
+  this->cleanup();
+  this->reserve(count);
+  this->count = count;
+  this->descendants.assign((size_t)count * this->stride, 0);
+  this->ancestors.assign((size_t)count * this->stride, 0);
+
+  // sinks first: node descendants is union of its outputs descendants
+  std::vector<int> pending(count);
+  std::vector<nodeid> ready;
+  std::vector<nodeid> order;
+  for (nodeid id = 0; id < count; id++) {
+    pending[id] = graph.outputs(id).size();
+    if (pending[id] == 0) {
+      ready.push_back(id);
+    }
+  }
+
+  while (!ready.empty()) {
+    const nodeid a = ready.back();
+    ready.pop_back();
+    order.push_back(a);
+
+    uint64_t *row = this->descendants_row(a);
+    for (const edgeid &id : graph.outputs(a)) {
+      const nodeid b = graph.edges[id].nodeb();
+      set_bit(row, b);
+      or_row(row, this->descendants_row(b), this->stride);
+    }
+
+    for (const edgeid &id : graph.inputs(a)) {
+      const nodeid prev = graph.edges[id].nodea();
+      if (--pending[prev] == 0) {
+        ready.push_back(prev);
+      }
+    }
+  }
+
+  if ((int)order.size() < count) {
+    // graph has cycles. Closure of cyclic graph built edge by edge
+    std::fill(this->descendants.begin(), this->descendants.end(), 0);
+    for (const Edge &edge : graph.edges) {
+      if (edge.nodea() >= 0) {
+        this->add_edge(edge.nodea(), edge.nodeb());
+      }
+    }
+
+    return;
+  }
+
+  // sources first, reversed order
+  for (auto it = order.rbegin(); it != order.rend(); ++it) {
+    const nodeid b = *it;
+    uint64_t *row = this->ancestors_row(b);
+    for (const edgeid &id : graph.inputs(b)) {
+      const nodeid a = graph.edges[id].nodea();
+      set_bit(row, a);
+      or_row(row, this->ancestors_row(a), this->stride);
+    }
+  }
+}
+
+/**
+ * @brief updates rows of a, its ancestors, b and its descendants only
+ *
+ * @param a
+ * @param b
+ */
+void Reachability::add_edge(nodeid a, nodeid b) {
+  if (this->is_reachable(a, b)) {
+    // closure already has this path
+    return;
+  }
+
+  // rows below changed while merging if edge closes a cycle
+  this->scratch_descendants.assign(this->descendants_row(b),
+                                   this->descendants_row(b) + this->stride);
+  set_bit(this->scratch_descendants.data(), b);
+  this->scratch_ancestors.assign(this->ancestors_row(a),
+                                 this->ancestors_row(a) + this->stride);
+  set_bit(this->scratch_ancestors.data(), a);
+
+  const uint64_t *below = this->scratch_descendants.data();
+  const uint64_t *above = this->scratch_ancestors.data();
+  for_each_bit(above, this->stride, [&](nodeid id) {
+    or_row(this->descendants_row(id), below, this->stride);
+  });
+  for_each_bit(below, this->stride, [&](nodeid id) {
+    or_row(this->ancestors_row(id), above, this->stride);
+  });
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace tyngraph {
+
+typedef int nodeid;
+
+class Graph;
+
+/**
+ * Transitive closure index. Every node keeps packed bitsets of all its
+ * descendants and ancestors, so reachability checked with one bit test
+ */
+class Reachability {
+  int count;
+  // words per row
+  int stride;
+  std::vector<uint64_t> descendants;
+  std::vector<uint64_t> ancestors;
+  // row copies used while merging rows
+  std::vector<uint64_t> scratch_descendants;
+  std::vector<uint64_t> scratch_ancestors;
+
+  uint64_t *descendants_row(nodeid id) {
+    return this->descendants.data() + (size_t)id * this->stride;
+  }
+  uint64_t *ancestors_row(nodeid id) {
+    return this->ancestors.data() + (size_t)id * this->stride;
+  }
+  const uint64_t *descendants_row(nodeid id) const {
+    return this->descendants.data() + (size_t)id * this->stride;
+  }
+  const uint64_t *ancestors_row(nodeid id) const {
+    return this->ancestors.data() + (size_t)id * this->stride;
+  }
+
+  /**
+   * @brief resizes rows to fit nodes count. Keeps rows content
+   */
+  void reserve(int count);
+
+  template <typename F>
+  static void for_each_bit(const uint64_t *row, int words, F callback) {
+    for (int w = 0; w < words; w++) {
+      uint64_t bits = row[w];
+      while (bits) {
+        const int bit = __builtin_ctzll(bits);
+        bits &= bits - 1;
+        callback((nodeid)(w * 64 + bit));
+      }
+    }
+  }
+
+public:
+  Reachability() {
+    this->count = 0;
+    this->stride = 0;
+  }
+
+  /**
+   * @brief builds index from scratch. Rows filled in topological order
+   *
+   * @param graph
+   */
+  void build(Graph &graph);
+
+  /**
+   * @brief adds empty row for new node
+   */
+  void add_node();
+
+  /**
+   * @brief updates rows of a, its ancestors, b and its descendants only
+   *
+   * @param a
+   * @param b
+   */
+  void add_edge(nodeid a, nodeid b);
+
+  void cleanup() {
+    this->count = 0;
+    this->stride = 0;
+    this->descendants.clear();
+    this->ancestors.clear();
+  }
+
+  /**
+   * @returns true if there is path from a to b
+   */
+  bool is_reachable(nodeid a, nodeid b) const {
+    if (a < 0 || a >= this->count || b < 0 || b >= this->count) {
+      return false;
+    }
+
+    return (this->descendants_row(a)[b >> 6] >> (b & 63)) & 1;
+  }
+
+  /**
+   * @brief calls callback(nodeid) for every node reachable from id
+   */
+  template <typename F> void for_each_descendant(nodeid id, F callback) const {
+    if (id >= 0 && id < this->count) {
+      for_each_bit(this->descendants_row(id), this->stride, callback);
+    }
+  }
+
+  /**
+   * @brief calls callback(nodeid) for every node which reaches id
+   */
+  template <typename F> void for_each_ancestor(nodeid id, F callback) const {
+    if (id >= 0 && id < this->count) {
+      for_each_bit(this->ancestors_row(id), this->stride, callback);
+    }
+  }
+};
+
+} // namespace tyngraph
@@ -19,11 +19,6 @@ public:
     this->pos = {};
     this->leafid = -1;
   }
-  Skillicon(const Skillicon &s) {
-    this->texture = s.texture;
-    this->pos = s.pos;
-    this->leafid = s.leafid;
-  }
 
   int get_id() { return this->leafid; }
 
@@ -57,7 +52,7 @@ public:
       DrawText("---", dest.x + 8, dest.y + 8, fontsize, WHITE);
     }
 
-    DrawText(leaf->get_name().c_str(), dest.x + 8,
+    DrawText(leaf->get_name(), dest.x + 8,
              dest.y + dest.width - 8 - fontsize, fontsize, WHITE);
   }
 };
@@ -1,7 +1,14 @@
 #pragma once
 #include "graph.hpp"
+#include "symbols.hpp"
 #include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
 
 using namespace tyngraph;
 
@@ -19,6 +26,12 @@ enum class BranchProgressMode {
   MAXIMUM
 };
 
+struct StatModifier {
+  std::string stat;
+  // added to stat for every leaf point
+  float per_point;
+};
+
 struct Skillinfo {
   int points;
   int maxpoints;
@@ -26,84 +39,121 @@ struct Skillinfo {
   BranchProgressMode mode;
   std::string name;
   std::string bind;
+  std::vector<StatModifier> modifiers;
 };
 
-class Leaf {
+/**
+ * Leaf state change record
+ */
+struct LeafDelta {
   nodeid id;
-  Skillinfo info;
+  int old_points;
+  int new_points;
+  bool old_active;
+  bool new_active;
+};
 
-public:
-  Leaf(nodeid id) {
-    this->id = id;
-    Leaf();
-  }
-  Leaf() {
-    this->id = -1;
-    this->info = {};
-    this->setup(0, 0, false);
-  }
-  Leaf(const Leaf &l) {
-    this->id = l.id;
-    this->setup(l);
-  }
+/**
+ * Points change of single leaf
+ */
+struct LeafUpgrade {
+  nodeid id;
+  // negative value to downgrade
+  int points;
+};
 
-  int get_id() { return this->id; }
-  BranchProgressMode get_mode() const { return this->info.mode; }
-  bool is_active() const { return this->info.active; }
-  int get_points() const { return this->info.points; }
-  int get_maxpoints() const { return this->info.maxpoints; }
-  const std::string &get_name() const { return this->info.name; }
-  const std::string &get_bind() const { return this->info.bind; }
-  const bool has_bind() const { return this->get_bind().length() > 0; }
+enum class TreeEventType {
+  LEAF_ACTIVATED,
+  LEAF_DEACTIVATED,
+  POINTS_CHANGED,
+  BRANCH_ACTIVATED,
+  BRANCH_DEACTIVATED
+};
 
-  void setup(int points, int maxpoints, bool active,
-             BranchProgressMode mode = BranchProgressMode::ANY) {
-    this->info.points = points;
-    this->info.maxpoints = maxpoints;
-    this->info.active = active;
-    this->info.mode = mode;
-  }
-  void setup(const Leaf &l) { this->info = l.info; }
-  void setup(const Skillinfo &info) { this->info = info; }
+/**
+ * Leaf or branch state transition
+ */
+struct TreeEvent {
+  TreeEventType type;
+  // leaf id or branch id for BRANCH_ events
+  int id;
+  // POINTS_CHANGED only
+  int old_points;
+  int new_points;
+};
 
-  /**
-   * @param active
-   *
-   * @returns {int} points discarded if leaf was deactivated.
-   * Negative value
-   */
-  int set_active(bool active) {
-    this->info.active = active;
-    if (!active) {
-      return this->downgrade(this->get_points());
-    }
+/**
+ * Receives all events of single tree change at once
+ */
+typedef std::function<void(const TreeEvent *events, int count)> TreeListener;
 
-    return 0;
-  }
-  void activate() { this->set_active(true); }
+/**
+ * Complete points layout to check with validate()
+ */
+struct Allocation {
+  // indexed by leaf id
+  std::vector<int> points;
+  // max points allowed to spend. -1 for no limit
+  int budget = -1;
+};
 
-  /**
-   * Upgrading possible even if leaf not active.
-   * Validate active status before calling this function
-   *
-   * @param points
-   *
-   * @return
-   */
-  int upgrade(int points = 1) {
-    int p = this->info.points;
-    this->info.points =
-        std::clamp(this->info.points + points, 0, this->info.maxpoints);
+enum class AllocationError {
+  NONE,
+  // points given for leaf which doesn't exist
+  UNKNOWN_LEAF,
+  // leaf points out of [0, maxpoints]
+  POINTS_RANGE,
+  // leaf has points while its input branches keep it inactive
+  INACTIVE_LEAF,
+  // total points exceed budget
+  BUDGET
+};
 
-    return this->info.points - p;
-  }
+/**
+ * validate() result: first violating leaf in topological order and
+ * its input branch which isn't active
+ */
+struct AllocationCheck {
+  AllocationError error;
+  nodeid leaf;
+  edgeid branch;
+  // total points of allocation
+  int points;
 
-  /**
-   * @param points
-   *
-   * @returns {int} points was discarded. Negative value
-   */
-  int downgrade(int points = 1) { return this->upgrade(-points); }
+  bool is_valid() const { return this->error == AllocationError::NONE; }
+};
+
+/**
+ * Leaf reference which detects removed leafs and ids of other tree
+ */
+struct LeafHandle {
+  nodeid id = -1;
+  uint32_t generation = 0;
+};
+
+/**
+ * Branch reference which detects removed branches and ids of other tree
+ */
+struct BranchHandle {
+  edgeid id = -1;
+  uint32_t generation = 0;
+};
+
+/**
+ * Per-player allocation: points and active status of every leaf.
+ * Arrays indexed by leaf id
+ */
+class SkilltreeState {
+public:
+  std::vector<int> points;
+  std::vector<uint8_t> active;
+
+  int count() const { return this->points.size(); }
+
+  void resize(int count) {
+    this->points.resize(count, 0);
+    this->active.resize(count, 0);
+  }
 };
 
 class Branch {
@@ -119,125 +169,1671 @@ public:
     this->id = -1;
     this->mode = BranchProgressMode::ANY;
   }
-  Branch(const Branch &b) {
-    this->id = b.id;
-    this->mode = b.mode;
-  }
 
   BranchProgressMode get_mode() const { return this->mode; }
 
-  bool is_active(const Leaf *leaf) const {
-    if (!leaf->is_active()) {
+  /**
+   * @param maxpoints input leaf maxpoints
+   * @returns points input leaf needs for branch to be active
+   */
+  int required_points(int maxpoints) const {
+    switch (this->mode) {
+    case BranchProgressMode::ANY:
+      return 0;
+    case BranchProgressMode::MINIMUM:
+      return 1;
+    case BranchProgressMode::MAXIMUM:
+    default:
+      return maxpoints;
+    }
+  }
+
+  bool is_active(const class Leaf *leaf) const;
+
+  /**
+   * @param active input leaf active status
+   * @param points input leaf points
+   * @param maxpoints input leaf maxpoints
+   */
+  bool is_active(bool active, int points, int maxpoints) const {
+    if (!active) {
       return false;
     }
 
     switch (this->mode) {
     case BranchProgressMode::ANY:
-      return leaf->is_active();
+      return active;
     case BranchProgressMode::MINIMUM:
-      return leaf->is_active() && leaf->get_points() > 0;
+      return active && points > 0;
     case BranchProgressMode::MAXIMUM:
-      return leaf->is_active() && leaf->get_points() >= leaf->get_maxpoints();
+      return active && points >= maxpoints;
     default:
       return false;
     }
   }
 };
 
-class Skilltree {
+/**
+ * Tree topology and leafs properties. Has no per-player data, so one
+ * definition shared by any amount of SkilltreeState. All state operations
+ * are const and can run from several threads once definition prepared
+ */
+class SkilltreeDefinition {
+public:
   Graph graph;
-  std::map<nodeid, Leaf> leafs;
-  std::map<edgeid, Branch> branches;
+  // indexed by leaf id
+  std::vector<int> maxpoints;
+  std::vector<BranchProgressMode> modes;
+  // names, binds and stats are symbols of one table
+  SymbolTable symbols;
+  std::vector<int> names;
+  std::vector<int> binds;
+  // state new allocations start from
+  SkilltreeState initial;
+  // stat name symbols, index is stat id
+  std::vector<int> stats;
+  // indexed by symbol: leaf with such name and stat id, -1 if none
+  std::vector<nodeid> symbol_leafs = {-1};
+  std::vector<int> symbol_stats = {-1};
+  // stat id and value per point of every leaf modifier
+  std::vector<std::vector<std::pair<int, float>>> modifiers;
+  // indexed by branch id
+  std::vector<Branch> branches;
+  // generation of every leaf and branch, 0 if removed
+  std::vector<uint32_t> leaf_generations;
+  std::vector<uint32_t> branch_generations;
+  // last generation given. Keep it when tree rebuilt, so old handles
+  // never match new ids
+  uint32_t generation = 0;
+  // first branch added in current batch
+  edgeid batch_start = 0;
 
-public:
-  void cleanup() {
-    this->leafs.clear();
-    this->branches.clear();
-    this->graph.cleanup();
-  }
+  int count_leafs() const { return this->graph.count_nodes(); }
 
   nodeid add_leaf() {
     const nodeid id = this->graph.add_node();
-    this->leafs[id] = Leaf(id);
+    this->maxpoints.push_back(0);
+    this->modes.push_back(BranchProgressMode::ANY);
+    this->names.push_back(0);
+    this->binds.push_back(0);
+    this->initial.resize(id + 1);
+    this->modifiers.emplace_back();
+    this->leaf_generations.push_back(++this->generation);
 
     return id;
   }
 
-  Leaf *get_leaf(int id) { return &this->leafs[id]; }
+  /**
+   * @returns {int} symbol id, lookup tables grown to fit it
+   */
+  int intern(std::string_view string) {
+    const int symbol = this->symbols.intern(string);
+    if (symbol >= (int)this->symbol_leafs.size()) {
+      this->symbol_leafs.resize(symbol + 1, -1);
+      this->symbol_stats.resize(symbol + 1, -1);
+    }
+
+    return symbol;
+  }
+
+  const char *get_name(nodeid id) const {
+    return this->symbols.c_str(this->names[id]);
+  }
+
+  const char *get_bind(nodeid id) const {
+    return this->symbols.c_str(this->binds[id]);
+  }
+
+  /**
+   * @brief renames leaf. Empty name isn't searchable
+   */
+  void set_name(nodeid id, std::string_view name) {
+    const int was = this->names[id];
+    if (this->symbol_leafs[was] == id) {
+      this->symbol_leafs[was] = -1;
+    }
+
+    const int symbol = this->intern(name);
+    this->names[id] = symbol;
+    if (symbol != 0) {
+      this->symbol_leafs[symbol] = id;
+    }
+  }
+
+  /**
+   * @returns {nodeid} leaf last given this name or -1
+   */
+  nodeid find_leaf(std::string_view name) const {
+    const int symbol = this->symbols.find(name);
+    if (symbol < 0 || symbol >= (int)this->symbol_leafs.size()) {
+      return -1;
+    }
+
+    return this->symbol_leafs[symbol];
+  }
+
+  int count_stats() const { return this->stats.size(); }
+
+  const char *get_stat_name(int stat) const {
+    return this->symbols.c_str(this->stats[stat]);
+  }
+
+  /**
+   * @returns {int} stat id. New stat registered if there is no such
+   */
+  int add_stat(std::string_view name) {
+    const int symbol = this->intern(name);
+    if (this->symbol_stats[symbol] < 0) {
+      this->symbol_stats[symbol] = this->stats.size();
+      this->stats.push_back(symbol);
+    }
+
+    return this->symbol_stats[symbol];
+  }
+
+  /**
+   * @returns {int} stat id or -1 if no leaf modifies it
+   */
+  int find_stat(std::string_view name) const {
+    const int symbol = this->symbols.find(name);
+    if (symbol < 0 || symbol >= (int)this->symbol_stats.size()) {
+      return -1;
+    }
+
+    return this->symbol_stats[symbol];
+  }
+
+  LeafHandle leaf_handle(nodeid id) const {
+    if (!this->graph.has_node(id)) {
+      return LeafHandle();
+    }
+
+    return {id, this->leaf_generations[id]};
+  }
 
-  Node *get_node(int id) { return &this->graph.nodes[id]; }
+  BranchHandle branch_handle(edgeid id) const {
+    if (!this->graph.has_edge(id)) {
+      return BranchHandle();
+    }
+
+    return {id, this->branch_generations[id]};
+  }
+
+  bool is_valid(LeafHandle handle) const {
+    return handle.id >= 0 && handle.id < (int)this->leaf_generations.size() &&
+           handle.generation != 0 &&
+           this->leaf_generations[handle.id] == handle.generation;
+  }
 
-  void add_branch(nodeid a, nodeid b,
-                  BranchProgressMode mode = BranchProgressMode::MAXIMUM) {
-    const edgeid id = this->graph.add_edge(a, b);
-    this->branches[id] = Branch(id, mode);
+  bool is_valid(BranchHandle handle) const {
+    return handle.id >= 0 &&
+           handle.id < (int)this->branch_generations.size() &&
+           handle.generation != 0 &&
+           this->branch_generations[handle.id] == handle.generation;
   }
 
-  Branch *get_branch(int id) { return &this->branches[id]; }
+  /**
+   * @brief sets leaf numbers, name, bind and modifiers are kept
+   */
+  void setup_leaf(nodeid id, int points, int maxpoints, bool active,
+                  BranchProgressMode mode) {
+    if (this->maxpoints[id] != maxpoints) {
+      this->maxpoints[id] = maxpoints;
+      for (const auto &eid : this->graph.outputs(id)) {
+        this->graph.set_weight(eid,
+                               this->branches[eid].required_points(maxpoints));
+      }
+    }
+    this->modes[id] = mode;
+    this->initial.points[id] = points;
+    this->initial.active[id] = active;
+  }
 
-  Edge *get_edge(int id) { return &this->graph.edges[id]; }
+  void setup_leaf(nodeid id, const Skillinfo &info) {
+    this->setup_leaf(id, info.points, info.maxpoints, info.active, info.mode);
+    this->set_name(id, info.name);
+    this->binds[id] = this->intern(info.bind);
+    this->modifiers[id].clear();
+    for (const auto &modifier : info.modifiers) {
+      this->modifiers[id].push_back(
+          {this->add_stat(modifier.stat), modifier.per_point});
+    }
+  }
 
   /**
-   * refreshes all subleafs. Call it after upgrade or downgrade
+   * Branch edge weight is points its input leaf needs to open it
    *
+   * @returns {edgeid} new branch id or -1 if any leaf doesn't exist or
+   * branch would close a cycle. In batch mode cycles found on commit()
+   */
+  edgeid add_branch(nodeid a, nodeid b, BranchProgressMode mode) {
+    if (!this->graph.has_node(a) || !this->graph.has_node(b) || a == b ||
+        (!this->graph.is_batching() && this->graph.creates_cycle(a, b))) {
+      return -1;
+    }
+
+    const Branch branch(this->graph.count_edges(), mode);
+    const edgeid id =
+        this->graph.add_edge(a, b, branch.required_points(this->maxpoints[a]));
+    this->branches.resize(id + 1);
+    this->branches[id] = branch;
+    this->branch_generations.resize(id + 1, 0);
+    this->branch_generations[id] = ++this->generation;
+
+    return id;
+  }
+
+  void remove_branch(edgeid id) {
+    if (this->graph.remove_edge(id)) {
+      this->branches[id] = Branch();
+      this->branch_generations[id] = 0;
+    }
+  }
+
+  void remove_leaf(nodeid id) {
+    if (!this->graph.has_node(id)) {
+      return;
+    }
+
+    for (const auto &eid : this->graph.outputs(id)) {
+      this->branches[eid] = Branch();
+      this->branch_generations[eid] = 0;
+    }
+    for (const auto &eid : this->graph.inputs(id)) {
+      this->branches[eid] = Branch();
+      this->branch_generations[eid] = 0;
+    }
+    this->set_name(id, "");
+    this->leaf_generations[id] = 0;
+    this->graph.remove_node(id);
+  }
+
+  void begin_batch() {
+    this->batch_start = this->graph.count_edges();
+    this->graph.begin_batch();
+  }
+
+  /**
+   * @returns {std::vector<edgeid>} branches added in batch and removed
+   * because they close cycles
+   */
+  std::vector<edgeid> commit() {
+    const std::vector<edgeid> removed =
+        this->graph.break_cycles(this->batch_start);
+    for (const edgeid &id : removed) {
+      this->branches[id] = Branch();
+      this->branch_generations[id] = 0;
+    }
+    this->graph.commit();
+
+    return removed;
+  }
+
+  /**
+   * Sorts graph so const operations could be used
+   */
+  void prepare() { this->graph.prepare(); }
+
+  SkilltreeState make_state() const {
+    SkilltreeState state = this->initial;
+    state.resize(this->count_leafs());
+
+    return state;
+  }
+
+  /**
+   * @param state
    * @param id
-   * @returns {int} amount of points was discarded on downgrade.
+   * @param active
+   *
+   * @returns {int} points discarded if leaf was deactivated.
    * Negative value
    */
-  int refresh_leaf(int id) {
-    int points_delta = 0;
-    Leaf *leaf = this->get_leaf(id);
-    Node *node = this->get_node(id);
+  int set_active(SkilltreeState &state, nodeid id, bool active) const {
+    state.active[id] = active;
+    if (!active) {
+      return this->upgrade(state, id, -state.points[id]);
+    }
+
+    return 0;
+  }
+
+  /**
+   * Upgrading possible even if leaf not active.
+   * Validate active status before calling this function
+   *
+   * @param state
+   * @param id
+   * @param points
+   *
+   * @returns {int} points actually added. Negative if downgraded
+   */
+  int upgrade(SkilltreeState &state, nodeid id, int points = 1) const {
+    const int p = state.points[id];
+    state.points[id] = std::clamp(p + points, 0, this->maxpoints[id]);
+
+    return state.points[id] - p;
+  }
 
-    // ---
-    // update leaf active status itself
+  /**
+   * @returns active status of leaf defined by its input branches and mode
+   */
+  bool resolve_active(const SkilltreeState &state, nodeid id) const {
     int active_branches = 0;
     int total_branches = 0;
-    for (const auto &eid : node->edges) {
-      const Edge *edge = this->get_edge(eid);
-      if (edge->nodeb() != id) {
-        continue;
-      }
-
+    for (const auto &eid : this->graph.inputs(id)) {
+      const nodeid a = this->graph.edges[eid].nodea();
       total_branches += 1;
-      const Branch *branch = this->get_branch(eid);
-      const Leaf *leafb = this->get_leaf(edge->nodea());
 
-      if (branch->is_active(leafb)) {
+      if (this->branches[eid].is_active(state.active[a], state.points[a],
+                                        this->maxpoints[a])) {
         active_branches += 1;
       }
     }
 
-    // active status depends on input branches and leaf mode
-    bool active = false;
-    switch (leaf->get_mode()) {
+    return is_leaf_active(this->modes[id], active_branches, total_branches);
+  }
+
+  /**
+   * Active status depends on input branches and leaf mode
+   *
+   * @param mode leaf mode
+   * @param active_branches
+   * @param total_branches
+   */
+  static bool is_leaf_active(BranchProgressMode mode, int active_branches,
+                             int total_branches) {
+    switch (mode) {
     case BranchProgressMode::ANY:
     case BranchProgressMode::MINIMUM:
-      active = active_branches > 0;
-      break;
+      return active_branches > 0;
     case BranchProgressMode::MAXIMUM:
-      active = active_branches >= total_branches;
-      break;
+      return active_branches >= total_branches;
     default:
-      active = false;
+      return false;
+    }
+  }
+
+  /**
+   * Checks points layout in one pass over leafs and branches.
+   * No state changed, no memory allocated once scratch grown
+   *
+   * @param allocation
+   * @returns {AllocationCheck} first violation found
+   */
+  AllocationCheck validate(const Allocation &allocation) const {
+    AllocationCheck check = {AllocationError::NONE, -1, -1, 0};
+    const std::vector<int> &points = allocation.points;
+    const int count = points.size();
+
+    for (nodeid id = 0; id < count; id++) {
+      check.points += points[id];
+      if (points[id] != 0 && !this->graph.has_node(id)) {
+        return {AllocationError::UNKNOWN_LEAF, id, -1, check.points};
+      }
     }
 
-    points_delta += leaf->set_active(active);
+    std::vector<uint8_t> &active = this->get_worklist(0).active;
+    if ((int)active.size() < this->count_leafs()) {
+      active.resize(this->count_leafs());
+    }
 
-    // ---
-    // refresh all dependent leafs
-    for (const auto &eid : node->edges) {
-      const Edge *edge = this->get_edge(eid);
-      if (edge->nodea() != id) {
+    for (const nodeid id : this->graph.topological_order()) {
+      if (!this->graph.has_node(id)) {
         continue;
       }
 
-      Leaf *leafb = this->get_leaf(edge->nodeb());
+      const int p = id < count ? points[id] : 0;
+      if (p < 0 || p > this->maxpoints[id]) {
+        check.error = AllocationError::POINTS_RANGE;
+        check.leaf = id;
+        return check;
+      }
+
+      // leafs before id already checked: every leaf with points is active
+      int active_branches = 0;
+      int total_branches = 0;
+      edgeid inactive_branch = -1;
+      for (const auto &eid : this->graph.inputs(id)) {
+        const nodeid a = this->graph.edges[eid].nodea();
+        total_branches += 1;
+
+        if (this->branches[eid].is_active(active[a], a < count ? points[a] : 0,
+                                          this->maxpoints[a])) {
+          active_branches += 1;
+        } else if (inactive_branch < 0) {
+          inactive_branch = eid;
+        }
+      }
+
+      active[id] =
+          is_leaf_active(this->modes[id], active_branches, total_branches);
+      if (p > 0 && !active[id]) {
+        check.error = AllocationError::INACTIVE_LEAF;
+        check.leaf = id;
+        check.branch = inactive_branch;
+        return check;
+      }
+    }
+
+    if (allocation.budget >= 0 && check.points > allocation.budget) {
+      check.error = AllocationError::BUDGET;
+    }
+
+    return check;
+  }
+
+  /**
+   * Refreshes leafs and their subleafs. Leafs visited in topological order,
+   * each one once at most. Subleafs visited only if their input branch
+   * changed state
+   *
+   * @param state
+   * @param ids leafs which points were changed, missing leafs skipped
+   * @param count
+   * @param changed if set, changed leafs are appended
+   * @returns {int} amount of points was discarded. Negative value
+   */
+  int refresh_leafs(SkilltreeState &state, const nodeid *ids, int count,
+                    std::vector<LeafDelta> *changed = nullptr) const {
+    int points_delta = 0;
+    Worklist &worklist = this->get_worklist(this->count_leafs());
+    const unsigned int seed_stamp = worklist.stamp;
+
+    for (int i = 0; i < count; i++) {
+      if (this->graph.has_node(ids[i])) {
+        worklist.push(ids[i], this->graph.topological_position(ids[i]),
+                      seed_stamp);
+      }
+    }
+
+    while (!worklist.empty()) {
+      const nodeid id = worklist.pop();
 
-      points_delta += this->refresh_leaf(leafb->get_id());
+      const bool was_active = state.active[id];
+      const int was_points = state.points[id];
+      const bool seed = worklist.marks[id] == seed_stamp;
+
+      points_delta +=
+          this->set_active(state, id, this->resolve_active(state, id));
+
+      const bool updated =
+          was_active != state.active[id] || was_points != state.points[id];
+      if (updated && changed != nullptr) {
+        changed->push_back({id, was_points, state.points[id], was_active,
+                            (bool)state.active[id]});
+      }
+      if (!updated && !seed) {
+        continue;
+      }
+
+      for (const auto &eid : this->graph.outputs(id)) {
+        const Branch *branch = &this->branches[eid];
+        const bool was = branch->is_active(was_active, was_points,
+                                           this->maxpoints[id]);
+        const bool is = branch->is_active(state.active[id], state.points[id],
+                                          this->maxpoints[id]);
+        if (seed || was != is) {
+          const nodeid b = this->graph.edges[eid].nodeb();
+          worklist.push(b, this->graph.topological_position(b),
+                        seed_stamp + 1);
+        }
+      }
     }
 
     return points_delta;
   }
-};
+
+  /**
+   * refreshes all leafs
+   *
+   * @param state
+   * @param changed if set, changed leafs are appended
+   * @returns {int} amount of points was discarded. Negative value
+   */
+  int refresh(SkilltreeState &state,
+              std::vector<LeafDelta> *changed = nullptr) const {
+    std::vector<nodeid> ids;
+    for (nodeid id = 0; id < this->count_leafs(); id++) {
+      if (this->graph.has_node(id)) {
+        ids.push_back(id);
+      }
+    }
+
+    return this->refresh_leafs(state, ids.data(), ids.size(), changed);
+  }
+
+  /**
+   * Applies upgrades and refreshes tree once. Changes rolled back if
+   * any upgraded leaf stays inactive or points budget exceeded.
+   * Upgrades of one leaf summed before clamping to its points range,
+   * so order of upgrades doesn't matter
+   *
+   * @param state
+   * @param upgrades
+   * @param count
+   * @param budget max points allowed to spend. -1 for no limit
+   * @param journal receives all changes made. Used for rollback
+   * @param points_delta if set, receives points spent. Negative value
+   * if points was discarded
+   * @returns {bool} false if changes rolled back
+   */
+  bool apply(SkilltreeState &state, const LeafUpgrade *upgrades, int count,
+             int budget, std::vector<LeafDelta> &journal,
+             int *points_delta = nullptr) const {
+    int delta = 0;
+    bool valid = true;
+    journal.clear();
+
+    Worklist &worklist = this->get_worklist(0);
+    std::vector<nodeid> &seeds = worklist.seeds;
+    seeds.clear();
+    std::vector<LeafUpgrade> &merged = worklist.upgrades;
+    merged.assign(upgrades, upgrades + count);
+    std::sort(merged.begin(), merged.end(),
+              [](const LeafUpgrade &l, const LeafUpgrade &r) {
+                return l.id < r.id;
+              });
+    size_t merged_count = 0;
+    for (const LeafUpgrade &upgrade : merged) {
+      if (merged_count > 0 && merged[merged_count - 1].id == upgrade.id) {
+        merged[merged_count - 1].points += upgrade.points;
+      } else {
+        merged[merged_count++] = upgrade;
+      }
+    }
+    merged.resize(merged_count);
+
+    for (const LeafUpgrade &upgrade : merged) {
+      if (!this->graph.has_node(upgrade.id)) {
+        valid = false;
+        break;
+      }
+
+      const int points = state.points[upgrade.id];
+      const bool active = state.active[upgrade.id];
+      delta += this->upgrade(state, upgrade.id, upgrade.points);
+      journal.push_back(
+          {upgrade.id, points, state.points[upgrade.id], active, active});
+      seeds.push_back(upgrade.id);
+    }
+
+    if (valid) {
+      delta += this->refresh_leafs(state, seeds.data(), seeds.size(), &journal);
+    }
+
+    // points can't stay in leafs which not reachable
+    for (size_t i = 0; i < merged.size() && valid; i++) {
+      if (merged[i].points > 0 && !state.active[merged[i].id]) {
+        valid = false;
+      }
+    }
+
+    if (budget >= 0 && delta > budget) {
+      valid = false;
+    }
+
+    if (!valid) {
+      for (auto it = journal.rbegin(); it != journal.rend(); ++it) {
+        state.points[it->id] = it->old_points;
+        state.active[it->id] = it->old_active;
+      }
+      journal.clear();
+      delta = 0;
+    }
+
+    if (points_delta != nullptr) {
+      *points_delta = delta;
+    }
+
+    return valid;
+  }
+
+private:
+  /**
+   * refresh_leafs scratch: (topological position, leaf id) min heap.
+   * One per thread, so shared definition needs no locks
+   */
+  struct Worklist {
+    std::vector<std::pair<int, nodeid>> queue;
+    std::vector<unsigned int> marks;
+    std::vector<nodeid> seeds;
+    // apply() upgrades summed per leaf
+    std::vector<LeafUpgrade> upgrades;
+    // validate() active flags
+    std::vector<uint8_t> active;
+    // leafs marked with stamp were updated by caller,
+    // with stamp + 1 - queued by propagation
+    unsigned int stamp = 0;
+
+    void push(nodeid id, int position, unsigned int mark) {
+      if (this->marks[id] >= this->stamp) {
+        return;
+      }
+
+      this->marks[id] = mark;
+      this->queue.push_back({position, id});
+      std::push_heap(this->queue.begin(), this->queue.end(),
+                     std::greater<std::pair<int, nodeid>>());
+    }
+
+    nodeid pop() {
+      std::pop_heap(this->queue.begin(), this->queue.end(),
+                    std::greater<std::pair<int, nodeid>>());
+      const nodeid id = this->queue.back().second;
+      this->queue.pop_back();
+
+      return id;
+    }
+
+    bool empty() const { return this->queue.empty(); }
+  };
+
+  /**
+   * @param count leafs count. Starts new refresh if not zero
+   */
+  static Worklist &get_worklist(int count) {
+    static thread_local Worklist worklist;
+    if (count == 0) {
+      return worklist;
+    }
+
+    worklist.stamp += 2;
+    if (worklist.stamp < 2) {
+      std::fill(worklist.marks.begin(), worklist.marks.end(), 0);
+      worklist.stamp = 2;
+    }
+    if ((int)worklist.marks.size() < count) {
+      worklist.marks.resize(count, 0);
+    }
+    worklist.queue.clear();
+
+    return worklist;
+  }
+};
+
+class Skilltree;
+
+/**
+ * Leaf of Skilltree: definition properties and state of one id
+ */
+class Leaf {
+  nodeid id;
+  Skilltree *tree;
+
+public:
+  Leaf(nodeid id, Skilltree *tree) {
+    this->id = id;
+    this->tree = tree;
+  }
+  Leaf() {
+    this->id = -1;
+    this->tree = nullptr;
+  }
+
+  int get_id() { return this->id; }
+  inline BranchProgressMode get_mode() const;
+  inline bool is_active() const;
+  inline int get_points() const;
+  inline int get_maxpoints() const;
+  // interned strings, valid until tree edited
+  inline const char *get_name() const;
+  inline const char *get_bind() const;
+  inline std::vector<StatModifier> get_modifiers() const;
+  const bool has_bind() const { return this->get_bind()[0] != '\0'; }
+
+  inline void setup(int points, int maxpoints, bool active,
+                    BranchProgressMode mode = BranchProgressMode::ANY);
+  inline void setup(const Leaf &l);
+  inline void setup(const Skillinfo &info);
+
+  /**
+   * Sets state directly, without any checks. Used to restore saved state.
+   * Not recorded, clears undo history
+   */
+  inline void set_state(int points, bool active);
+
+  /**
+   * Not recorded, clears undo history
+   *
+   * @param active
+   *
+   * @returns {int} points discarded if leaf was deactivated.
+   * Negative value
+   */
+  inline int set_active(bool active);
+  void activate() { this->set_active(true); }
+
+  /**
+   * Upgrading possible even if leaf not active.
+   * Validate active status before calling this function.
+   * Not recorded, clears undo history. See Skilltree::upgrade_leaf()
+   *
+   * @param points
+   *
+   * @return
+   */
+  inline int upgrade(int points = 1);
+
+  /**
+   * @param points
+   *
+   * @returns {int} points was discarded. Negative value
+   */
+  int downgrade(int points = 1) { return this->upgrade(-points); }
+};
+
+/**
+ * Undo/redo journal of state edits. Steps are runs of leaf deltas stored
+ * in a ring buffer, oldest steps dropped when buffer is full
+ */
+class EditHistory {
+  // ring of deltas, grows on demand up to capacity
+  std::vector<LeafDelta> deltas;
+  size_t capacity;
+  // deltas count of every kept step, oldest first
+  std::deque<int> steps;
+  // undoable steps count, steps after it can be redone
+  int step;
+  // ring positions: kept deltas are [begin, end), undoable [begin, cursor)
+  size_t begin;
+  size_t cursor;
+  size_t end;
+
+  LeafDelta &at(size_t position) {
+    return this->deltas[position % this->deltas.size()];
+  }
+
+  /**
+   * @brief grows ring to fit size deltas, capacity at most. Kept deltas
+   * moved to ring start
+   */
+  void reserve(size_t size) {
+    if (size <= this->deltas.size() || this->deltas.size() == this->capacity) {
+      return;
+    }
+
+    std::vector<LeafDelta> grown(
+        std::min(std::max(size, this->deltas.size() * 2), this->capacity));
+    for (size_t position = this->begin; position < this->end; position++) {
+      grown[position - this->begin] = this->at(position);
+    }
+    this->cursor -= this->begin;
+    this->end -= this->begin;
+    this->begin = 0;
+    this->deltas.swap(grown);
+  }
+
+public:
+  /**
+   * @param capacity max deltas kept. Ring allocated as steps recorded
+   */
+  EditHistory(int capacity = 1 << 16) { this->set_capacity(capacity); }
+
+  /**
+   * @brief sets max deltas kept. Drops whole history
+   */
+  void set_capacity(int capacity) {
+    this->capacity = std::max(capacity, 1);
+    this->deltas = std::vector<LeafDelta>();
+    this->clear();
+  }
+
+  void clear() {
+    this->steps.clear();
+    this->step = 0;
+    this->begin = 0;
+    this->cursor = 0;
+    this->end = 0;
+  }
+
+  bool can_undo() const { return this->step > 0; }
+  bool can_redo() const { return this->step < (int)this->steps.size(); }
+
+  /**
+   * @brief records changes of one edit as single step. Drops redo steps
+   *
+   * @param changes
+   * @param count
+   */
+  void record(const LeafDelta *changes, int count) {
+    if (count == 0) {
+      return;
+    }
+
+    this->steps.resize(this->step);
+    this->end = this->cursor;
+    if (count > (int)this->capacity) {
+      this->clear();
+      return;
+    }
+
+    this->reserve(this->end - this->begin + count);
+    while (this->end - this->begin + count > this->deltas.size()) {
+      this->begin += this->steps.front();
+      this->steps.pop_front();
+      this->step -= 1;
+    }
+
+    for (int i = 0; i < count; i++) {
+      this->at(this->end + i) = changes[i];
+    }
+    this->end += count;
+    this->cursor = this->end;
+    this->steps.push_back(count);
+    this->step += 1;
+  }
+
+  /**
+   * @brief restores state before last step
+   *
+   * @param state
+   * @param applied if set, restored changes are appended
+   * @returns {int} points change. Negative value if points was discarded
+   */
+  int undo(SkilltreeState &state, std::vector<LeafDelta> *applied = nullptr) {
+    if (!this->can_undo()) {
+      return 0;
+    }
+
+    int points_delta = 0;
+    const int count = this->steps[this->step - 1];
+    for (int i = 1; i <= count; i++) {
+      const LeafDelta &delta = this->at(this->cursor - i);
+      if (applied != nullptr) {
+        applied->push_back({delta.id, state.points[delta.id],
+                            delta.old_points, (bool)state.active[delta.id],
+                            delta.old_active});
+      }
+      state.points[delta.id] = delta.old_points;
+      state.active[delta.id] = delta.old_active;
+      points_delta += delta.old_points - delta.new_points;
+    }
+    this->cursor -= count;
+    this->step -= 1;
+
+    return points_delta;
+  }
+
+  /**
+   * @brief applies step undone last
+   *
+   * @param state
+   * @param applied if set, applied changes are appended
+   * @returns {int} points change. Negative value if points was discarded
+   */
+  int redo(SkilltreeState &state, std::vector<LeafDelta> *applied = nullptr) {
+    if (!this->can_redo()) {
+      return 0;
+    }
+
+    int points_delta = 0;
+    const int count = this->steps[this->step];
+    for (int i = 0; i < count; i++) {
+      const LeafDelta &delta = this->at(this->cursor + i);
+      if (applied != nullptr) {
+        applied->push_back({delta.id, state.points[delta.id],
+                            delta.new_points, (bool)state.active[delta.id],
+                            delta.new_active});
+      }
+      state.points[delta.id] = delta.new_points;
+      state.active[delta.id] = delta.new_active;
+      points_delta += delta.new_points - delta.old_points;
+    }
+    this->cursor += count;
+    this->step += 1;
+
+    return points_delta;
+  }
+};
+
+/**
+ * Single player tree: definition and its state. Definition shared with
+ * get_definition() copied on first topology change
+ */
+class Skilltree {
+  friend class Leaf;
+
+  std::shared_ptr<SkilltreeDefinition> definition;
+  SkilltreeState state;
+  std::vector<Leaf> leafs;
+
+  std::vector<LeafUpgrade> transaction;
+  std::vector<LeafDelta> transaction_journal;
+
+  EditHistory history;
+  std::vector<LeafDelta> history_changes;
+
+  // deque keeps listeners in place while new ones added during notify.
+  // Id -1 marks listener unsubscribed during notify, erased after it
+  std::deque<std::pair<int, TreeListener>> listeners;
+  int listener_guid = 0;
+  // nested notify() calls in progress
+  int notify_depth = 0;
+  // changes of refresh caller didn't ask for, collected for listeners
+  std::vector<LeafDelta> event_changes;
+  std::vector<TreeEvent> events;
+  // net change index of every leaf while events built, -1 if none
+  std::vector<int> event_slots;
+  std::vector<LeafDelta> event_net;
+
+  // preview() scratch, reused between calls
+  SkilltreeState preview_state;
+  std::vector<LeafDelta> preview_changes;
+  std::vector<TreeEvent> preview_events;
+
+  /**
+   * @returns list refresh should fill: caller one, own one if there are
+   * listeners or nullptr
+   */
+  std::vector<LeafDelta> *track(std::vector<LeafDelta> *changed,
+                                size_t *first) {
+    *first = changed != nullptr ? changed->size() : 0;
+    if (changed != nullptr || this->listeners.empty()) {
+      return changed;
+    }
+
+    this->event_changes.clear();
+    return &this->event_changes;
+  }
+
+  void notify(const std::vector<LeafDelta> *changes, size_t first) {
+    if (changes != nullptr && changes->size() > first) {
+      this->notify(changes->data() + first, changes->size() - first);
+    }
+  }
+
+  void notify_leaf(nodeid id, int old_points, bool old_active) {
+    if (!this->listeners.empty()) {
+      const LeafDelta delta = {id, old_points, this->state.points[id],
+                               old_active, (bool)this->state.active[id]};
+      this->notify(&delta, 1);
+    }
+  }
+
+  /**
+   * @brief turns leaf changes into events and sends them to listeners
+   */
+  void notify(const LeafDelta *changes, int count) {
+    if (this->listeners.empty() || count == 0) {
+      return;
+    }
+
+    this->collect_events(changes, count, this->events);
+    if (this->events.empty()) {
+      return;
+    }
+
+    // listeners may change tree again, that builds own events. Listeners
+    // subscribed meanwhile get only next events
+    std::vector<TreeEvent> events;
+    events.swap(this->events);
+    this->notify_depth += 1;
+    const size_t subscribed = this->listeners.size();
+    for (size_t i = 0; i < subscribed; i++) {
+      if (this->listeners[i].first >= 0) {
+        this->listeners[i].second(events.data(), events.size());
+      }
+    }
+    this->notify_depth -= 1;
+    events.clear();
+    this->events.swap(events);
+
+    if (this->notify_depth == 0) {
+      this->listeners.erase(
+          std::remove_if(this->listeners.begin(), this->listeners.end(),
+                         [](const auto &entry) { return entry.first < 0; }),
+          this->listeners.end());
+    }
+  }
+
+  /**
+   * @brief turns leaf changes into events. Several changes of one leaf
+   * merged into one
+   *
+   * @param changes
+   * @param count
+   * @param events cleared before filled
+   */
+  void collect_events(const LeafDelta *changes, int count,
+                      std::vector<TreeEvent> &events) {
+    const SkilltreeDefinition *definition = this->prepared();
+    this->event_slots.resize(definition->count_leafs(), -1);
+    this->event_net.clear();
+    for (int i = 0; i < count; i++) {
+      const LeafDelta &delta = changes[i];
+      int &slot = this->event_slots[delta.id];
+      if (slot < 0) {
+        slot = this->event_net.size();
+        this->event_net.push_back(delta);
+      } else {
+        this->event_net[slot].new_points = delta.new_points;
+        this->event_net[slot].new_active = delta.new_active;
+      }
+    }
+
+    events.clear();
+    for (const LeafDelta &delta : this->event_net) {
+      this->event_slots[delta.id] = -1;
+      if (delta.old_active != delta.new_active) {
+        events.push_back({delta.new_active ? TreeEventType::LEAF_ACTIVATED
+                                           : TreeEventType::LEAF_DEACTIVATED,
+                          delta.id, 0, 0});
+      }
+      if (delta.old_points != delta.new_points) {
+        events.push_back({TreeEventType::POINTS_CHANGED, delta.id,
+                          delta.old_points, delta.new_points});
+      }
+
+      // branch state depends on its input leaf only
+      const int maxpoints = definition->maxpoints[delta.id];
+      for (const auto &eid : definition->graph.outputs(delta.id)) {
+        const Branch &branch = definition->branches[eid];
+        const bool was =
+            branch.is_active(delta.old_active, delta.old_points, maxpoints);
+        const bool is =
+            branch.is_active(delta.new_active, delta.new_points, maxpoints);
+        if (was != is) {
+          events.push_back({is ? TreeEventType::BRANCH_ACTIVATED
+                               : TreeEventType::BRANCH_DEACTIVATED,
+                            eid, 0, 0});
+        }
+      }
+    }
+  }
+
+  /**
+   * @returns definition safe to change
+   */
+  SkilltreeDefinition *edit() {
+    if (this->definition.use_count() > 1) {
+      this->definition =
+          std::make_shared<SkilltreeDefinition>(*this->definition);
+    }
+
+    return this->definition.get();
+  }
+
+  /**
+   * @returns definition ready for const operations
+   */
+  const SkilltreeDefinition *prepared() {
+    this->definition->prepare();
+
+    return this->definition.get();
+  }
+
+public:
+  Skilltree() { this->definition = std::make_shared<SkilltreeDefinition>(); }
+  Skilltree(const Skilltree &t) { *this = t; }
+  Skilltree &operator=(const Skilltree &t) {
+    if (this == &t) {
+      return *this;
+    }
+
+    this->definition = t.definition;
+    this->state = t.state;
+    this->transaction = t.transaction;
+    this->history = t.history;
+    // listeners belong to source tree
+    this->leafs.clear();
+    for (nodeid id = 0; id < (int)t.leafs.size(); id++) {
+      this->leafs.push_back(Leaf(id, this));
+    }
+
+    return *this;
+  }
+
+  void cleanup() {
+    this->leafs.clear();
+    this->state = SkilltreeState();
+    this->transaction.clear();
+    this->history.clear();
+    const uint32_t generation = this->definition->generation;
+    this->definition = std::make_shared<SkilltreeDefinition>();
+    this->definition->generation = generation;
+  }
+
+  /**
+   * @returns tree definition to share between several states.
+   * Definition is not changed after that
+   */
+  std::shared_ptr<const SkilltreeDefinition> get_definition() {
+    this->definition->prepare();
+
+    return this->definition;
+  }
+
+  /**
+   * @returns current definition without sharing it. Pointer valid until
+   * next topology change
+   */
+  const SkilltreeDefinition *read_definition() const {
+    return this->definition.get();
+  }
+
+  const SkilltreeState &get_state() const { return this->state; }
+
+  /**
+   * @param state allocation made for same definition
+   */
+  void set_state(const SkilltreeState &state) {
+    this->state = state;
+    this->state.resize(this->definition->count_leafs());
+    this->history.clear();
+  }
+
+  nodeid add_leaf() {
+    const nodeid id = this->edit()->add_leaf();
+    this->state.resize(id + 1);
+    this->leafs.push_back(Leaf(id, this));
+    // recorded steps assume old tree
+    this->history.clear();
+
+    return id;
+  }
+
+  /**
+   * @returns leaf or nullptr if there is no such leaf
+   */
+  Leaf *get_leaf(int id) {
+    if (!this->definition->graph.has_node(id)) {
+      return nullptr;
+    }
+
+    return &this->leafs[id];
+  }
+
+  /**
+   * @returns leaf or nullptr if leaf was removed since handle taken
+   */
+  Leaf *get_leaf(LeafHandle handle) {
+    if (!this->definition->is_valid(handle)) {
+      return nullptr;
+    }
+
+    return &this->leafs[handle.id];
+  }
+
+  LeafHandle get_leaf_handle(nodeid id) const {
+    return this->definition->leaf_handle(id);
+  }
+
+  const Node *get_node(int id) {
+    if (!this->definition->graph.has_node(id)) {
+      return nullptr;
+    }
+
+    return &this->definition->graph.nodes[id];
+  }
+
+  /**
+   * Branches can't form cycles: leaf can't depend on itself
+   *
+   * @param a input leaf
+   * @param b output leaf
+   * @param mode
+   * @returns {edgeid} new branch id or -1 if any leaf doesn't exist or
+   * branch would close a cycle
+   */
+  edgeid add_branch(nodeid a, nodeid b,
+                    BranchProgressMode mode = BranchProgressMode::MAXIMUM) {
+    this->history.clear();
+
+    return this->edit()->add_branch(a, b, mode);
+  }
+
+  /**
+   * Removes branch and refreshes leafs below it
+   *
+   * @param id branch id
+   * @returns {int} amount of points was discarded. Negative value
+   */
+  int remove_branch(edgeid id) {
+    if (!this->definition->graph.has_edge(id)) {
+      return 0;
+    }
+
+    const nodeid b = this->get_edge(id)->nodeb();
+    this->edit()->remove_branch(id);
+    // discarded points not recorded, undo would refund them twice
+    this->history.clear();
+
+    return this->refresh_leaf(b);
+  }
+
+  /**
+   * Removes leaf with all its branches and refreshes leafs below it
+   *
+   * @param id leaf id
+   * @returns {int} amount of points was discarded. Negative value
+   */
+  int remove_leaf(nodeid id) {
+    if (!this->definition->graph.has_node(id)) {
+      return 0;
+    }
+
+    std::vector<nodeid> dependent;
+    for (const auto &eid : this->outputs(id)) {
+      dependent.push_back(this->get_edge(eid)->nodeb());
+    }
+
+    const int points = this->state.points[id];
+    const bool active = this->state.active[id];
+    this->state.points[id] = 0;
+    this->state.active[id] = false;
+    // removed leaf has no outputs anymore, notified before
+    this->notify_leaf(id, points, active);
+    this->edit()->remove_leaf(id);
+    this->history.clear();
+
+    return this->refresh_leafs(dependent.data(), dependent.size()) - points;
+  }
+
+  /**
+   * Branches added between begin_batch() and commit() only recorded.
+   * Use it when loading whole tree
+   */
+  void begin_batch() { this->edit()->begin_batch(); }
+
+  /**
+   * Checks all batch branches for cycles at once
+   *
+   * @returns {std::vector<edgeid>} ids returned by add_branch() in batch
+   * and removed because they close cycles. Earlier added branches kept
+   */
+  std::vector<edgeid> commit() { return this->edit()->commit(); }
+
+  /**
+   * @returns branch or nullptr if there is no such branch
+   */
+  const Branch *get_branch(int id) {
+    if (!this->definition->graph.has_edge(id)) {
+      return nullptr;
+    }
+
+    return &this->definition->branches[id];
+  }
+
+  /**
+   * @returns branch or nullptr if branch was removed since handle taken
+   */
+  const Branch *get_branch(BranchHandle handle) {
+    if (!this->definition->is_valid(handle)) {
+      return nullptr;
+    }
+
+    return &this->definition->branches[handle.id];
+  }
+
+  BranchHandle get_branch_handle(edgeid id) const {
+    return this->definition->branch_handle(id);
+  }
+
+  /**
+   * @returns edge or nullptr if there is no such branch
+   */
+  const Edge *get_edge(int id) {
+    if (!this->definition->graph.has_edge(id)) {
+      return nullptr;
+    }
+
+    return &this->definition->graph.edges[id];
+  }
+
+  EdgeSpan outputs(nodeid id) { return this->prepared()->graph.outputs(id); }
+
+  EdgeSpan inputs(nodeid id) { return this->prepared()->graph.inputs(id); }
+
+  /**
+   * Starts transaction: upgrades queued with queue_upgrade() and
+   * applied all at once by commit_transaction()
+   */
+  void begin_transaction() { this->transaction.clear(); }
+
+  /**
+   * @param id leaf id
+   * @param points points to add. Negative value to downgrade
+   */
+  void queue_upgrade(nodeid id, int points = 1) {
+    this->transaction.push_back({id, points});
+  }
+
+  /**
+   * Applies queued upgrades and refreshes tree once. Changes rolled back if
+   * any upgraded leaf stays inactive or points budget exceeded.
+   * Upgrades of one leaf summed before clamping to its points range,
+   * so order of queued upgrades doesn't matter
+   *
+   * @param budget max points transaction allowed to spend. -1 for no limit
+   * @param points_delta if set, receives points spent. Negative value
+   * if points was discarded
+   * @returns {bool} false if transaction rolled back
+   */
+  bool commit_transaction(int budget = -1, int *points_delta = nullptr) {
+    const bool valid = this->prepared()->apply(
+        this->state, this->transaction.data(), this->transaction.size(),
+        budget, this->transaction_journal, points_delta);
+    this->transaction.clear();
+    this->history.record(this->transaction_journal.data(),
+                         this->transaction_journal.size());
+    this->notify(&this->transaction_journal, 0);
+
+    return valid;
+  }
+
+  /**
+   * Drops queued upgrades
+   */
+  void cancel_transaction() { this->transaction.clear(); }
+
+  /**
+   * @returns changes made by last committed transaction
+   */
+  const std::vector<LeafDelta> &get_transaction_changes() const {
+    return this->transaction_journal;
+  }
+
+  /**
+   * Upgrades leaf and refreshes subleafs. Recorded as one undo step
+   *
+   * @param id
+   * @param points points to add. Negative value to downgrade
+   * @returns {int} points change, including points discarded by refresh
+   */
+  int upgrade_leaf(nodeid id, int points = 1) {
+    if (!this->definition->graph.has_node(id)) {
+      return 0;
+    }
+
+    const SkilltreeDefinition *definition = this->prepared();
+    const int was_points = this->state.points[id];
+    const bool active = this->state.active[id];
+    int points_delta = definition->upgrade(this->state, id, points);
+
+    this->history_changes.clear();
+    this->history_changes.push_back(
+        {id, was_points, this->state.points[id], active, active});
+    points_delta += definition->refresh_leafs(this->state, &id, 1,
+                                              &this->history_changes);
+
+    // upgrade of inactive leaf is discarded by refresh, nothing to record
+    bool changed = this->state.points[id] != was_points ||
+                   this->state.active[id] != active;
+    for (const auto &delta : this->history_changes) {
+      changed = changed || delta.id != id;
+    }
+    if (changed) {
+      this->history.record(this->history_changes.data(),
+                           this->history_changes.size());
+      this->notify(&this->history_changes, 0);
+    }
+
+    return points_delta;
+  }
+
+  /**
+   * Computes what upgrade_leaf() would change without changing tree.
+   * Cheap enough to call every frame
+   *
+   * @param id
+   * @param direction points to add. Negative value to downgrade
+   * @param points_delta if set, receives points would be spent.
+   * Negative value if points would be refunded
+   * @returns changes as events, valid until next preview() call
+   */
+  const std::vector<TreeEvent> &preview(nodeid id, int direction,
+                                        int *points_delta = nullptr) {
+    this->preview_events.clear();
+    if (points_delta != nullptr) {
+      *points_delta = 0;
+    }
+    if (!this->definition->graph.has_node(id)) {
+      return this->preview_events;
+    }
+
+    // scratch copy keeps its capacity, so no allocations after first call
+    const SkilltreeDefinition *definition = this->prepared();
+    this->preview_state.points.assign(this->state.points.begin(),
+                                      this->state.points.end());
+    this->preview_state.active.assign(this->state.active.begin(),
+                                      this->state.active.end());
+
+    const int was_points = this->preview_state.points[id];
+    const bool active = this->preview_state.active[id];
+    int delta = definition->upgrade(this->preview_state, id, direction);
+    this->preview_changes.clear();
+    this->preview_changes.push_back(
+        {id, was_points, this->preview_state.points[id], active, active});
+    delta += definition->refresh_leafs(this->preview_state, &id, 1,
+                                       &this->preview_changes);
+
+    this->collect_events(this->preview_changes.data(),
+                         this->preview_changes.size(), this->preview_events);
+    if (points_delta != nullptr) {
+      *points_delta = delta;
+    }
+
+    return this->preview_events;
+  }
+
+  /**
+   * Reverts last upgrade_leaf() or transaction
+   *
+   * @returns {int} points change. Negative value if points was discarded
+   */
+  int undo() {
+    this->history_changes.clear();
+    const int points_delta =
+        this->history.undo(this->state, &this->history_changes);
+    this->notify(&this->history_changes, 0);
+
+    return points_delta;
+  }
+
+  /**
+   * Applies again last undone step
+   *
+   * @returns {int} points change. Negative value if points was discarded
+   */
+  int redo() {
+    this->history_changes.clear();
+    const int points_delta =
+        this->history.redo(this->state, &this->history_changes);
+    this->notify(&this->history_changes, 0);
+
+    return points_delta;
+  }
+
+  bool can_undo() const { return this->history.can_undo(); }
+  bool can_redo() const { return this->history.can_redo(); }
+
+  /**
+   * @param capacity max leaf deltas kept. Drops whole history
+   */
+  void set_history_capacity(int capacity) {
+    this->history.set_capacity(capacity);
+  }
+
+  /**
+   * Checks points layout without touching tree state
+   *
+   * @param allocation
+   * @returns {AllocationCheck} first violation found
+   */
+  AllocationCheck validate(const Allocation &allocation) {
+    return this->prepared()->validate(allocation);
+  }
+
+  /**
+   * refreshes all subleafs. Call it after upgrade or downgrade.
+   * Not recorded, clears undo history
+   *
+   * @param id
+   * @param changed if set, leafs which active status or points
+   * were changed by refresh are appended
+   * @returns {int} amount of points was discarded on downgrade.
+   * Negative value, 0 if leaf doesn't exist
+   */
+  int refresh_leaf(int id, std::vector<LeafDelta> *changed = nullptr) {
+    if (!this->definition->graph.has_node(id)) {
+      return 0;
+    }
+
+    return this->refresh_leafs(&id, 1, changed);
+  }
+
+  /**
+   * refreshes all leafs. Call it after leafs setup.
+   * Not recorded, clears undo history
+   *
+   * @param changed if set, changed leafs are appended
+   * @returns {int} amount of points was discarded. Negative value
+   */
+  int refresh(std::vector<LeafDelta> *changed = nullptr) {
+    size_t first;
+    std::vector<LeafDelta> *journal = this->track(changed, &first);
+    const int points_delta = this->prepared()->refresh(this->state, journal);
+    this->history.clear();
+    this->notify(journal, first);
+
+    return points_delta;
+  }
+
+  /**
+   * Refreshes leafs and their subleafs. Each leaf visited once at most.
+   * Not recorded, clears undo history
+   *
+   * @param ids leafs which points were changed
+   * @param count
+   * @param changed if set, changed leafs are appended
+   * @returns {int} amount of points was discarded. Negative value
+   */
+  int refresh_leafs(const nodeid *ids, int count,
+                    std::vector<LeafDelta> *changed = nullptr) {
+    size_t first;
+    std::vector<LeafDelta> *journal = this->track(changed, &first);
+    const int points_delta =
+        this->prepared()->refresh_leafs(this->state, ids, count, journal);
+    this->history.clear();
+    this->notify(journal, first);
+
+    return points_delta;
+  }
+
+  /**
+   * Listener called after every change of leafs or branches state made by
+   * upgrades, refreshes, transactions and undo. cleanup() and set_state()
+   * replace whole state and aren't reported
+   *
+   * @param listener
+   * @returns {int} subscription id
+   */
+  int subscribe(TreeListener listener) {
+    this->listeners.push_back({this->listener_guid, listener});
+
+    return this->listener_guid++;
+  }
+
+  /**
+   * Safe to call from listener, removed listener isn't called anymore
+   *
+   * @param id subscription id
+   */
+  void unsubscribe(int id) {
+    for (auto it = this->listeners.begin(); it != this->listeners.end(); ++it) {
+      if (it->first != id) {
+        continue;
+      }
+
+      if (this->notify_depth > 0) {
+        // listener may be running, erased after outermost notify
+        it->first = -1;
+      } else {
+        this->listeners.erase(it);
+      }
+      return;
+    }
+  }
+};
+
+BranchProgressMode Leaf::get_mode() const {
+  return this->tree->definition->modes[this->id];
+}
+bool Leaf::is_active() const { return this->tree->state.active[this->id]; }
+int Leaf::get_points() const { return this->tree->state.points[this->id]; }
+int Leaf::get_maxpoints() const {
+  return this->tree->definition->maxpoints[this->id];
+}
+const char *Leaf::get_name() const {
+  return this->tree->definition->get_name(this->id);
+}
+const char *Leaf::get_bind() const {
+  return this->tree->definition->get_bind(this->id);
+}
+std::vector<StatModifier> Leaf::get_modifiers() const {
+  const SkilltreeDefinition *definition = this->tree->definition.get();
+  std::vector<StatModifier> modifiers;
+  for (const auto &[stat, per_point] : definition->modifiers[this->id]) {
+    modifiers.push_back({definition->get_stat_name(stat), per_point});
+  }
+
+  return modifiers;
+}
+
+void Leaf::setup(int points, int maxpoints, bool active,
+                 BranchProgressMode mode) {
+  this->tree->edit()->setup_leaf(this->id, points, maxpoints, active, mode);
+  this->set_state(points, active);
+}
+void Leaf::setup(const Leaf &l) {
+  Skillinfo info;
+  info.points = l.get_points();
+  info.maxpoints = l.get_maxpoints();
+  info.active = l.is_active();
+  info.mode = l.get_mode();
+  info.name = l.get_name();
+  info.bind = l.get_bind();
+  info.modifiers = l.get_modifiers();
+  this->setup(info);
+}
+void Leaf::setup(const Skillinfo &info) {
+  this->tree->edit()->setup_leaf(this->id, info);
+  this->set_state(info.points, info.active);
+}
+
+void Leaf::set_state(int points, bool active) {
+  const int was_points = this->get_points();
+  const bool was_active = this->is_active();
+  this->tree->state.points[this->id] = points;
+  this->tree->state.active[this->id] = active;
+  this->tree->history.clear();
+  this->tree->notify_leaf(this->id, was_points, was_active);
+}
+
+int Leaf::set_active(bool active) {
+  const int was_points = this->get_points();
+  const bool was_active = this->is_active();
+  const int points_delta = this->tree->definition->set_active(
+      this->tree->state, this->id, active);
+  this->tree->history.clear();
+  this->tree->notify_leaf(this->id, was_points, was_active);
+
+  return points_delta;
+}
+
+int Leaf::upgrade(int points) {
+  const int was_points = this->get_points();
+  const int points_delta =
+      this->tree->definition->upgrade(this->tree->state, this->id, points);
+  this->tree->history.clear();
+  this->tree->notify_leaf(this->id, was_points, this->is_active());
+
+  return points_delta;
+}
+
+inline bool Branch::is_active(const Leaf *leaf) const {
+  return this->is_active(leaf->is_active(), leaf->get_points(),
+                         leaf->get_maxpoints());
+}
 } // namespace tynskills
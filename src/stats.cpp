@@ -0,0 +1,44 @@
+#include "stats.hpp"
+
+using namespace tynskills;
+
+StatAggregator::StatAggregator(Skilltree *tree) {
+  this->tree = tree;
+  this->rebuild();
+  this->subscription =
+      tree->subscribe([this](const TreeEvent *events, int count) {
+        for (int i = 0; i < count; i++) {
+          const TreeEvent &event = events[i];
+          if (event.type == TreeEventType::POINTS_CHANGED) {
+            this->add(event.id, event.new_points - event.old_points);
+          }
+        }
+      });
+}
+
+StatAggregator::~StatAggregator() {
+  this->tree->unsubscribe(this->subscription);
+}
+
+void StatAggregator::add(nodeid id, int points) {
+  const SkilltreeDefinition *definition = this->tree->read_definition();
+  if ((int)this->totals.size() < definition->count_stats()) {
+    this->totals.resize(definition->count_stats(), 0);
+  }
+
+  for (const auto &[stat, per_point] : definition->modifiers[id]) {
+    this->totals[stat] += (double)per_point * points;
+  }
+}
+
+void StatAggregator::rebuild() {
+  const SkilltreeDefinition *definition = this->tree->read_definition();
+  this->totals.assign(definition->count_stats(), 0);
+
+  const SkilltreeState &state = this->tree->get_state();
+  for (nodeid id = 0; id < definition->count_leafs(); id++) {
+    if (definition->graph.has_node(id) && state.points[id] != 0) {
+      this->add(id, state.points[id]);
+    }
+  }
+}
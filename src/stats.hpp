@@ -0,0 +1,56 @@
+#pragma once
+#include "skilltree.hpp"
+#include <string>
+#include <vector>
+
+namespace tynskills {
+
+/**
+ * Running totals of stats modified by allocated leafs. Follows tree
+ * events, so every points change costs only modifiers of changed leaf
+ * and reading stat is single lookup.
+ *
+ * Skilltree::set_state() and cleanup() aren't reported by events,
+ * call rebuild() after them
+ */
+class StatAggregator {
+  Skilltree *tree;
+  int subscription;
+  // indexed by stat id
+  std::vector<double> totals;
+
+  /**
+   * @brief adds leaf modifiers multiplied by points
+   */
+  void add(nodeid id, int points);
+
+public:
+  StatAggregator(Skilltree *tree);
+  ~StatAggregator();
+  StatAggregator(const StatAggregator &) = delete;
+  StatAggregator &operator=(const StatAggregator &) = delete;
+
+  /**
+   * @brief sums all leafs again
+   */
+  void rebuild();
+
+  int count() const { return this->totals.size(); }
+
+  /**
+   * @param stat stat id, see SkilltreeDefinition::find_stat()
+   */
+  double get(int stat) const {
+    if (stat < 0 || stat >= (int)this->totals.size()) {
+      return 0;
+    }
+
+    return this->totals[stat];
+  }
+
+  double get(const std::string &name) const {
+    return this->get(this->tree->read_definition()->find_stat(name));
+  }
+};
+
+} // namespace tynskills
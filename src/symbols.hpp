@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tynskills {
+
+/**
+ * Interned strings. Every distinct string stored once in flat buffer and
+ * referred by compact id, id 0 is empty string. Holds no pointers, so
+ * table copied or moved as three flat arrays whatever strings count is
+ */
+class SymbolTable {
+  // strings data, every one null terminated
+  std::string chars;
+  // start of every symbol in chars, last one is chars end
+  std::vector<uint32_t> offsets;
+  // open addressing hash set of symbol ids, -1 if slot empty.
+  // Size is power of two, at most half full
+  std::vector<int> slots;
+
+  /**
+   * @returns slot holding string or empty slot it should be placed to
+   */
+  size_t probe(std::string_view string) const {
+    const size_t mask = this->slots.size() - 1;
+    size_t slot = std::hash<std::string_view>()(string) & mask;
+    while (this->slots[slot] >= 0 && this->get(this->slots[slot]) != string) {
+      slot = (slot + 1) & mask;
+    }
+
+    return slot;
+  }
+
+  void grow() {
+    this->slots.assign(this->slots.size() * 2, -1);
+    for (int id = 0; id < this->count(); id++) {
+      this->slots[this->probe(this->get(id))] = id;
+    }
+  }
+
+public:
+  SymbolTable() {
+    this->offsets.push_back(0);
+    this->slots.assign(16, -1);
+    this->intern("");
+  }
+
+  int count() const { return this->offsets.size() - 1; }
+
+  /**
+   * @returns {int} symbol id. New symbol added if there is no such string
+   */
+  int intern(std::string_view string) {
+    const size_t slot = this->probe(string);
+    if (this->slots[slot] >= 0) {
+      return this->slots[slot];
+    }
+
+    const int id = this->count();
+    this->chars.append(string);
+    this->chars.push_back('\0');
+    this->offsets.push_back(this->chars.size());
+    this->slots[slot] = id;
+    if ((size_t)this->count() * 2 > this->slots.size()) {
+      this->grow();
+    }
+
+    return id;
+  }
+
+  /**
+   * @returns {int} symbol id or -1 if string never interned
+   */
+  int find(std::string_view string) const {
+    return this->slots[this->probe(string)];
+  }
+
+  std::string_view get(int id) const {
+    const uint32_t begin = this->offsets[id];
+    return std::string_view(this->chars.data() + begin,
+                            this->offsets[id + 1] - begin - 1);
+  }
+
+  const char *c_str(int id) const {
+    return this->chars.data() + this->offsets[id];
+  }
+};
+
+} // namespace tynskills
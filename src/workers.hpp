@@ -0,0 +1,77 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace tyngraph {
+
+/**
+ * @brief resolves worker threads count. Web builds have no threads
+ *
+ * @param threads requested count. 0 to use all cores
+ * @param jobs work items count, no more workers than items
+ * @returns {int} threads count in [1, max(jobs, 1)]
+ */
+inline int resolve_threads(int threads, int jobs) {
+  if (threads <= 0) {
+    threads = std::thread::hardware_concurrency();
+  }
+#if defined(PLATFORM_WEB)
+  threads = 1;
+#endif
+
+  return std::clamp(threads, 1, std::max(jobs, 1));
+}
+
+/**
+ * @brief runs work(index) on threads workers and waits for all of them.
+ * Calling thread is worker 0, so one worker spawns no threads
+ *
+ * @param threads resolved count, see resolve_threads()
+ * @param work
+ */
+template <typename Work> void run_workers(int threads, const Work &work) {
+  std::vector<std::thread> workers;
+  for (int i = 1; i < threads; i++) {
+    workers.emplace_back(work, i);
+  }
+  work(0);
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+}
+
+/**
+ * Shared cursor handing out [0, count) range to workers by chunks
+ */
+class WorkQueue {
+  std::atomic<int> cursor;
+  int count;
+  int grain;
+
+public:
+  WorkQueue(int count, int grain = 1) : cursor(0) {
+    this->count = count;
+    this->grain = grain;
+  }
+
+  /**
+   * @brief takes next chunk
+   *
+   * @param begin
+   * @param end
+   * @returns false if whole range taken
+   */
+  bool take(int &begin, int &end) {
+    begin = this->cursor.fetch_add(this->grain);
+    if (begin >= this->count) {
+      return false;
+    }
+
+    end = std::min(begin + this->grain, this->count);
+    return true;
+  }
+};
+
+} // namespace tyngraph